@@ -35,6 +35,13 @@
 #define RAD_TRANS (1)
 #define POL (1)
 
+// Unpolarized transfer from the observer towards the source, which ends the
+// ray once the optical depth in front exceeds TAU_STOP at all frequencies.
+// 1 transfers the lightpath in segments; 2 streams every geodesic step into
+// the transfer without storing the lightpath (not with GEO_CACHE)
+#define OBSERVER_SIDE (0)
+#define TAU_STOP (20.)
+
 #define num_frequencies 1
 
 #define FREQFILE (0)
@@ -82,6 +89,11 @@ typedef struct Camera {
 
 #define DEXTER (0) // use Dexter fit for rho_V_thermal
 
+// Interpolate the kappa/power-law coefficients from tables instead of
+// evaluating the fits. Tables are cached in EMIS_TABLE_FILE_<df>.bin
+#define EMIS_TABLE (0)
+#define EMIS_TABLE_FILE "emission_table"
+
 // METRIC PARAMETERS
 ////////////////////
 
@@ -127,16 +139,32 @@ typedef struct Camera {
 #define OUTER_BOUND_POL (1000.) // Stop polarized integration beyond this radius
 
 #define delta_num (1.e-4) // Used for numerical derivatives
-#define max_steps (1e5)   // Maximum number of integration steps
+#define max_steps (1e5)   // Initial lightpath size, grows when needed
+#define max_steps_hard (1e6) // Maximum number of integration steps
 
 #define cutoff_outer (1.1 * rcam) // Outer cutoff, near flat spacetime, in M
+#define FAST_FORWARD (0) // Place rays on the sphere FF_RADIUS analytically
+#define FF_RADIUS (1.1 * R_EMIT_MAX) // Outside all emission, in M
 #define horizon_marg (1.e-2) // Stop tracing at this distance from E.H. [BL]
 #define RK2 (1)              //
 #define VER (2)              //
 #define RK4 (3)              //
 #define RK45 (4)             //
+#define MINO (5)             // Kerr geodesics in Mino time
+#define DOPRI5 (6)           // Dormand-Prince 5(4), PI control, dense output
 #define int_method (RK2)     // method of integration
 
+// Integrate this many neighbouring camera rays in lockstep (RK2 and RK4). With
+// 4 or 8, and a matching -march, the metric is evaluated in SIMD registers.
+#define RAY_PACKET (1)
+
+// Store integrated geodesics on disk and reuse them in later runs with the
+// same spin, inclination, camera and integrator settings. For MKSBHAC the
+// step size also follows the AMR grid, only share a store between snapshots
+// on the same grid.
+#define GEO_CACHE (0)
+#define GEO_CACHE_FILE "geodesics.cache"
+
 // CONSTANTS
 ////////////
 
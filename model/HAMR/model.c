@@ -19,7 +19,11 @@
 
 // GLOBAL VARS
 //////////////
-double ****p;
+double *p;
+
+// Emission mask, see CAN_EMIT
+unsigned char *emit_mask;
+int mask_row;
 
 int N1, N2, N3;
 
@@ -113,9 +117,6 @@ void init_grmhd_data(char *fname) {
 
     double Rh = (1. + sqrt(1. - a * a));
 
-
-    init_storage();
-
     /* allocate the memory for dataset */
     x1_in = (double *)malloc(N1 * N2 * N3 * sizeof(double));
     x2_in = (double *)malloc(N1 * N2 * N3 * sizeof(double));
@@ -169,6 +170,14 @@ void init_grmhd_data(char *fname) {
     /* close HDF5 file */
     ret = H5Fclose(file_id);
 
+#if (EMISSION_MASK)
+    // The datasets are read whole, only the shells within the cutoff are
+    // stored
+    crop_radius();
+#endif
+
+    init_storage();
+
     /* find the index for event horizon ridius */
     for (i = 0; i < N1; i++) {
         if (r_in[i * N2 * N3] >= Rh) {
@@ -224,24 +233,25 @@ void init_grmhd_data(char *fname) {
                    be corrected. Or, we need to correct the theta correction
                    term in gcov_func  (pi -> pi/2)
                 */
-                p[KRHO][i][j][z] = RHO_in[gridIndex];
-                p[UU][i][j][z] = UU_in[gridIndex];
-                p[U1][i][j][z] = U1_in[gridIndex];
-                p[U2][i][j][z] = U2_in[gridIndex] / 2.;
-                p[U3][i][j][z] = U3_in[gridIndex];
-                p[B1][i][j][z] = B1_in[gridIndex];
-                p[B2][i][j][z] = B2_in[gridIndex] / 2.;
-                p[B3][i][j][z] = B3_in[gridIndex];
+                PRIM(i, j, z, KRHO) = RHO_in[gridIndex];
+                PRIM(i, j, z, UU) = UU_in[gridIndex];
+                PRIM(i, j, z, U1) = U1_in[gridIndex];
+                PRIM(i, j, z, U2) = U2_in[gridIndex] / 2.;
+                PRIM(i, j, z, U3) = U3_in[gridIndex];
+                PRIM(i, j, z, B1) = B1_in[gridIndex];
+                PRIM(i, j, z, B2) = B2_in[gridIndex] / 2.;
+                PRIM(i, j, z, B3) = B3_in[gridIndex];
                 gdet = gdet_in[gridIndex2D];
                 Ucov0 = Ucov0_in[gridIndex];
                 Ucon0 = Ucon0_in[gridIndex];
 
                 /* check accretion rate */
                 if (i == ieh)
-                    dMact += gdet * p[KRHO][i][j][z] * p[U1][i][j][z] * Ucon0;
+                    dMact += gdet * PRIM(i, j, z, KRHO) * PRIM(i, j, z, U1) *
+                             Ucon0;
                 if (i >= 20 && i < 40)
-                    Ladv +=
-                        gdet * p[UU][i][j][z] * p[U1][i][j][z] * Ucon0 * Ucov0;
+                    Ladv += gdet * PRIM(i, j, z, UU) * PRIM(i, j, z, U1) *
+                            Ucon0 * Ucov0;
             }
         }
     }
@@ -266,6 +276,10 @@ void init_grmhd_data(char *fname) {
     free(Ucov0_in);
     free(Ucon0_in);
 
+#if (EMISSION_MASK)
+    build_emission_mask();
+#endif
+
     // bias_norm /= V;
     // dMact *= dx[3] * dx[2];
     /* since dx[2] was rearranged by dx[2] = dx[2]/2 while using gdet from the
@@ -300,10 +314,7 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
 
     int i, j, k;
     double del[NDIM];
-    double rho, uu;
-    double Bp[NDIM], V_u[NDIM], Vfac, VdotV, UdotBp;
-    double g_uu[NDIM][NDIM], g_dd[NDIM][NDIM], coeff[4];
-    double bsq, beta, beta_trans, b2, trat, Th_unit, two_temp_gam;
+    double coeff[4];
 
     if (X[1] < startx[1] || X[1] > stopx[1] || X[2] < startx[2] ||
         X[2] > stopx[2]) {
@@ -313,24 +324,47 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
 
     Xtoijk(X, &i, &j, &k, del);
 
-    metric_uu(X, g_uu);
-    metric_dd(X, g_dd);
+#if (EMISSION_MASK)
+    if (!CAN_EMIT(i, j, k)) {
+        (*modvar).n_e = 0.;
+        return 0;
+    }
+#endif
 
     coeff[1] = del[1];
     coeff[2] = del[2];
     coeff[3] = del[3];
 
-    rho = interp_scalar(p[KRHO], i, j, k, coeff);
-    uu = interp_scalar(p[UU], i, j, k, coeff);
+    double prim[NPRIM];
+    interp_prims(i, j, k, coeff, prim);
+
+    return fluid_params_from_prims(X, prim, modvar);
+}
+
+// Fills the fluid quantities at X from the primitives there, returns 0 if
+// they are cut from the emission
+int fluid_params_from_prims(double X[NDIM], double prim[NPRIM],
+                            struct GRMHD *modvar) {
+    int i, j;
+    double rho, uu;
+    double Bp[NDIM], V_u[NDIM], Vfac, VdotV, UdotBp;
+    double g_uu[NDIM][NDIM], g_dd[NDIM][NDIM];
+    double bsq, beta, beta_trans, b2, trat, Th_unit, two_temp_gam;
+
+    metric_uu(X, g_uu);
+    metric_dd(X, g_dd);
+
+    rho = prim[KRHO];
+    uu = prim[UU];
     (*modvar).n_e = rho * Ne_unit + 1e-40;
 
-    Bp[1] = interp_scalar(p[B1], i, j, k, coeff);
-    Bp[2] = interp_scalar(p[B2], i, j, k, coeff);
-    Bp[3] = interp_scalar(p[B3], i, j, k, coeff);
+    Bp[1] = prim[B1];
+    Bp[2] = prim[B2];
+    Bp[3] = prim[B3];
 
-    V_u[1] = interp_scalar(p[U1], i, j, k, coeff);
-    V_u[2] = interp_scalar(p[U2], i, j, k, coeff);
-    V_u[3] = interp_scalar(p[U3], i, j, k, coeff);
+    V_u[1] = prim[U1];
+    V_u[2] = prim[U2];
+    V_u[3] = prim[U3];
 
     VdotV = 0.;
     for (i = 1; i < NDIM; i++)
@@ -378,7 +412,7 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
 
 #if (DEBUG)
     if (uu < 0)
-        fprintf(stderr, "U %e %e\n", uu, p[UU][i][j][k]);
+        fprintf(stderr, "U %e %e\n", uu, prim[UU]);
     ;
 
     if ((*modvar).theta_e < 0)
@@ -386,10 +420,12 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
     if ((*modvar).B < 0)
         fprintf(stderr, "B %e\n", (*modvar).B);
     if ((*modvar).n_e < 0)
-        fprintf(stderr, "Ne %e %e\n", (*modvar).n_e, p[KRHO][i][j][k]);
+        fprintf(stderr, "Ne %e %e\n", (*modvar).n_e, prim[KRHO]);
 #endif
 
-    if (bsq / rho > 1. || exp(X[1]) > 50.) {
+    (*modvar).sigma = bsq / rho;
+
+    if ((*modvar).sigma > SIGMA_CUT || exp(X[1]) > R_EMIT_MAX) {
         (*modvar).n_e = 0;
         return 0;
     }
@@ -409,38 +445,26 @@ void set_units(double M_unit_) {
     Ne_unit = RHO_unit / (PROTON_MASS + ELECTRON_MASS);
 }
 
-double interp_scalar(double ***var, int i, int j, int k, double coeff[4]) {
-
-    double interp;
-    int ip1, jp1, kp1;
-    double b1, b2, b3, del[NDIM];
+// Interpolates all primitives around cell (i, j, k), the stencil is built
+// once and shared by the fields
+void interp_prims(int i, int j, int k, double del[4], double prim[NPRIM]) {
+    double *corner[8];
 
-    del[1] = coeff[1];
-    del[2] = coeff[2];
-    del[3] = coeff[3];
     if (del[1] > 1 || del[2] > 1 || del[3] > 1 || del[1] < 0 || del[2] < 0 ||
         del[3] < 0)
         fprintf(stderr, "del[1] %e \n del[2] %e\n del[3] %e\n", del[1], del[2],
                 del[3]);
 
-    ip1 = i + 1;
-    jp1 = j + 1;
-    kp1 = k + 1;
-
-    b1 = 1. - del[1];
-    b2 = 1. - del[2];
-    b3 = 1. - del[3];
-
-    interp = var[i][j][k] * b1 * b2 + var[i][jp1][k] * b1 * del[2] +
-             var[ip1][j][k] * del[1] * b2 + var[ip1][jp1][k] * del[1] * del[2];
+    corner[0] = &PRIM(i, j, k, 0);
+    corner[1] = &PRIM(i, j + 1, k, 0);
+    corner[2] = &PRIM(i + 1, j, k, 0);
+    corner[3] = &PRIM(i + 1, j + 1, k, 0);
+    corner[4] = &PRIM(i, j, k + 1, 0);
+    corner[5] = &PRIM(i, j + 1, k + 1, 0);
+    corner[6] = &PRIM(i + 1, j, k + 1, 0);
+    corner[7] = &PRIM(i + 1, j + 1, k + 1, 0);
 
-    /* Now interpolate above in x3 */
-    interp = b3 * interp + del[3] * (var[i][j][kp1] * b1 * b2 +
-                                     var[i][jp1][kp1] * b1 * del[2] +
-                                     var[ip1][j][kp1] * del[1] * b2 +
-                                     var[ip1][jp1][kp1] * del[1] * del[2]);
-
-    return interp;
+    interp_fields(corner, NPRIM, del, prim);
 }
 
 void Xtoijk(double X[NDIM], int *i, int *j, int *k, double del[NDIM]) {
@@ -519,22 +543,115 @@ double ***malloc_rank3(int n1, int n2, int n3) {
     return A;
 }
 
+// Allocates the primitives as one contiguous array ordered [i][j][k][prim],
+// so the stencil of a cell holds all of its primitives
 void init_storage(void) {
-    int i, j, k;
+    size_t size = (size_t)N1 * N2 * N3 * NPRIM;
+    p = (double *)malloc(size * sizeof(double));
+    if (p == NULL) {
+        fprintf(stderr, "Cannot allocate %g GB for the primitives\n",
+                size * sizeof(double) / 1e9);
+        exit(1);
+    }
+
+    return;
+}
+
+#if (EMISSION_MASK)
+// Drops the radial shells beyond where the model emits, only the polarized
+// transfer also stops at RT_OUTER_CUTOFF. The first shell past the crop is
+// kept so the stencils inside stay whole.
+void crop_radius(void) {
+#if (POL)
+    double r_crop = fmin(RT_OUTER_CUTOFF, R_EMIT_MAX);
+#else
+    double r_crop = R_EMIT_MAX;
+#endif
+    double X_u[NDIM] = {0., 0., 0., 0.};
+    for (int i = 1; i < N1 - 1; i++) {
+        X_u[1] = startx[1] + (i + 0.5) * dx[1];
+        if (get_r(X_u) > r_crop) {
+            fprintf(stderr, "\nCropped %d of %d radial shells beyond r = %g\n",
+                    N1 - i - 1, N1, r_crop);
+            N1 = i + 1;
+            break;
+        }
+    }
+    stopx[1] = startx[1] + N1 * dx[1];
+}
+
+// Whether the interpolation stencil with the given corner cells can emit,
+// which is when one of its corners can or a field component changes sign over
+// it, as interpolation then cancels the field and lowers sigma below that of
+// the corners
+int stencil_can_emit(unsigned char *emits, double *prims, size_t corner[8]) {
+    for (int n = 0; n < 8; n++)
+        if (emits[corner[n]])
+            return 1;
+
+    for (int q = B1; q <= B3; q++) {
+        int pos = 0, neg = 0;
+        for (int n = 0; n < 8; n++) {
+            pos |= (prims[corner[n] * NPRIM + q] > 0.);
+            neg |= (prims[corner[n] * NPRIM + q] < 0.);
+        }
+        if (pos && neg)
+            return 1;
+    }
+
+    return 0;
+}
 
-    p = (double ****)malloc(NPRIM * sizeof(double ***));
-    for (i = 0; i < NPRIM; i++) {
-        p[i] = (double ***)malloc(N1 * sizeof(double **));
-        for (j = 0; j < N1; j++) {
-            p[i][j] = (double **)malloc(N2 * sizeof(double *));
-            for (k = 0; k < N2; k++) {
-                p[i][j][k] = (double *)malloc(N3 * sizeof(double));
+// Sets the emission mask from the primitives. A cell can emit if its sigma is
+// below MASK_SIGMA_MARGIN times SIGMA_CUT, and the mask of a cell is set if
+// the interpolation stencil it starts can emit.
+void build_emission_mask(void) {
+    size_t size = (size_t)N1 * N2 * N3;
+    unsigned char *emits = (unsigned char *)malloc(size);
+    mask_row = (N3 + 7) / 8;
+    emit_mask = (unsigned char *)calloc((size_t)N1 * N2 * mask_row, 1);
+
+#pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int i = 0; i < N1; i++) {
+        for (int j = 0; j < N2; j++) {
+            for (int k = 0; k < N3; k++) {
+                double X_u[NDIM] = {0., startx[1] + (i + 0.5) * dx[1],
+                                    startx[2] + (j + 0.5) * dx[2],
+                                    (k + 0.5) * dx[3]};
+                struct GRMHD modvar;
+                fluid_params_from_prims(X_u, &PRIM(i, j, k, 0), &modvar);
+                emits[((size_t)i * N2 + j) * N3 + k] =
+                    !(modvar.sigma > MASK_SIGMA_MARGIN * SIGMA_CUT);
             }
         }
     }
 
-    return;
+    // Every row of the mask starts on a new byte, so rows can be set in
+    // parallel
+#pragma omp parallel for collapse(2)
+    for (int i = 0; i < N1; i++) {
+        for (int j = 0; j < N2; j++) {
+            int ip = (i + 1 < N1) ? i + 1 : i;
+            int jp = (j + 1 < N2) ? j + 1 : j;
+            for (int k = 0; k < N3; k++) {
+                int kp = (k + 1 < N3) ? k + 1 : k;
+                size_t corner[8];
+                for (int n = 0; n < 8; n++) {
+                    int ii = (n & 2) ? ip : i;
+                    int jj = (n & 1) ? jp : j;
+                    int kk = (n & 4) ? kp : k;
+                    corner[n] = ((size_t)ii * N2 + jj) * N3 + kk;
+                }
+                if (stencil_can_emit(emits, p, corner))
+                    emit_mask[((size_t)i * N2 + j) * mask_row + (k >> 3)] |=
+                        1 << (k & 7);
+            }
+        }
+    }
+
+    free(emits);
 }
+#endif
 
 void compute_spec_user(struct Camera *intensityfield,
                        double energy_spectrum[num_frequencies][nspec]) {
@@ -16,6 +16,18 @@
 #define NDIM 4
 #define NPRIM 8
 
+#define SIGMA_CUT (1.)
+// Outer radius of the emission
+#define R_EMIT_MAX (50.)
+
+// Drop radial shells beyond the emission at load time and keep a per-cell
+// mask of where sigma stays below SIGMA_CUT, samples that can not emit are
+// rejected before any metric or interpolation work
+#define EMISSION_MASK (0)
+// sigma of the interpolated fields is not bounded by that of the stencil
+// cells, so cells are masked only above this multiple of SIGMA_CUT
+#define MASK_SIGMA_MARGIN (2.)
+
 typedef struct GRMHD {
     double U_u[4];
     double B_u[4];
@@ -41,4 +53,14 @@ typedef struct GRMHD {
 #define B2 6
 #define B3 7
 
+// Primitive q of cell (i, j, k), p is stored as [i][j][k][prim]
+#define PRIM(i, j, k, q)                                                       \
+    p[(((size_t)(i) * N2 + (j)) * N3 + (k)) * NPRIM + (q)]
+
+// Set if the interpolation stencil starting at cell (i, j, k) holds a cell
+// that can emit, every (i, j) row starts on a new byte
+#define CAN_EMIT(i, j, k)                                                      \
+    (emit_mask[((size_t)(i) * N2 + (j)) * mask_row + ((k) >> 3)] &             \
+     (1 << ((k) & 7)))
+
 #endif // MODEL_DEFINITIONS_H
@@ -13,7 +13,16 @@
 #ifndef MODEL_FUNCTIONS_H
 #define MODEL_FUNCTIONS_H
 
-double interp_scalar(double ***var, int i, int j, int k, double coeff[4]);
+void interp_prims(int i, int j, int k, double del[4], double prim[NPRIM]);
+
+int fluid_params_from_prims(double X[NDIM], double prim[NPRIM],
+                            struct GRMHD *modvar);
+
+void crop_radius(void);
+
+int stencil_can_emit(unsigned char *emits, double *prims, size_t corner[8]);
+
+void build_emission_mask(void);
 void bl_coord(double *X, double *r, double *th);
 void coord(int i, int j, int k, double *X);
 
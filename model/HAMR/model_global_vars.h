@@ -13,7 +13,10 @@
 #ifndef MODEL_GLOBAL_VARS_H
 #define MODEL_GLOBAL_VARS_H
 
-extern double ****p;
+extern double *p;
+
+extern unsigned char *emit_mask;
+extern int mask_row;
 
 extern int N1, N2, N3;
 
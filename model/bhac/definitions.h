@@ -37,6 +37,13 @@
 #define RAD_TRANS (1)
 #define POL (0)
 
+// Unpolarized transfer from the observer towards the source, which ends the
+// ray once the optical depth in front exceeds TAU_STOP at all frequencies.
+// 1 transfers the lightpath in segments; 2 streams every geodesic step into
+// the transfer without storing the lightpath (not with GEO_CACHE)
+#define OBSERVER_SIDE (0)
+#define TAU_STOP (20.)
+
 #define num_frequencies (50)
 
 #define FREQFILE (0)
@@ -46,6 +53,13 @@
 
 #define EMISUSER (0)
 #define RADIAL_CUT (1)
+// 1: the bands are absorbed by all plasma along the ray and sum to the total,
+// as I_radial_cut always was; 0: each band holds the emission and absorption
+// of the plasma inside it alone
+#define RADIAL_CUT_SHARED (1)
+#if (RADIAL_CUT && !RADIAL_CUT_SHARED && OBSERVER_SIDE)
+#error "OBSERVER_SIDE transfers radial bands only with RADIAL_CUT_SHARED"
+#endif
 
 #define BREMSSTRAHLUNG (1)
 #define SYNCHROTRON (1)
@@ -96,6 +110,11 @@ typedef struct Camera {
 
 #define DEXTER (0) // use Dexter fit for rho_V_thermal
 
+// Interpolate the kappa/power-law coefficients from tables instead of
+// evaluating the fits. Tables are cached in EMIS_TABLE_FILE_<df>.bin
+#define EMIS_TABLE (0)
+#define EMIS_TABLE_FILE "emission_table"
+
 // METRIC PARAMETERS
 ////////////////////
 
@@ -143,16 +162,32 @@ typedef struct Camera {
 #define RT_OUTER_CUTOFF (1000.) // Stop polarized integration beyond this radius
 
 #define delta_num (1.e-4) // Used for numerical derivatives
-#define max_steps (1e4)   // Maximum number of integration steps
+#define max_steps (1e4)   // Initial lightpath size, grows when needed
+#define max_steps_hard (1e6) // Maximum number of integration steps
 
 #define cutoff_outer (1.1 * rcam) // Outer cutoff, near flat spacetime, in M
+#define FAST_FORWARD (0) // Place rays on the sphere FF_RADIUS analytically
+#define FF_RADIUS (1.1 * RT_OUTER_CUTOFF) // Outside all emission, in M
 #define horizon_marg (1.e-2) // Stop tracing at this distance from E.H. [BL]
 #define RK2 (1)              //
 #define VER (2)              //
 #define RK4 (3)              //
 #define RK45 (4)             //
+#define MINO (5)             // Kerr geodesics in Mino time
+#define DOPRI5 (6)           // Dormand-Prince 5(4), PI control, dense output
 #define int_method (RK45)
 
+// Integrate this many neighbouring camera rays in lockstep (RK2 and RK4). With
+// 4 or 8, and a matching -march, the metric is evaluated in SIMD registers.
+#define RAY_PACKET (1)
+
+// Store integrated geodesics on disk and reuse them in later runs with the
+// same spin, inclination, camera and integrator settings. For MKSBHAC the
+// step size also follows the AMR grid, so the store is rebuilt when the
+// block layout of the snapshot changes.
+#define GEO_CACHE (0)
+#define GEO_CACHE_FILE "geodesics.cache"
+
 // CONSTANTS
 ////////////
 
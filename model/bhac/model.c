@@ -6,6 +6,9 @@
  * Adapted by J. Davelaar August 2022
  */
 
+// posix_madvise, pread and sysconf are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
 #include "definitions.h"
 #include "functions.h"
 #include "global_vars.h"
@@ -13,10 +16,30 @@
 #include "model_functions.h"
 #include "model_global_vars.h"
 
+#include <fcntl.h>
+#include <omp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct snapshot_header {
+    char magic[8];
+    // key, a stored snapshot is only used if all of these match
+    int64_t version, metric_id, prim_float;
+    int64_t dump_size, dump_mtime, grid_size, grid_mtime;
+    int64_t emission_mask;
+    double rt_outer_cutoff, sigma_cut;
+    // contents
+    int64_t nleafs, ndimini, cells, nx[3], ng[3], neqpar, tree_nodes;
+    double xprobmin[3], xprobmax[3], hslope;
+    int64_t data_offset, mask_offset;
+} snapshot_header;
+
 // GLOBAL VARS
 //////////////
 
-double ****p;
+double *p;
 
 double L_unit, T_unit;
 double RHO_unit, U_unit, B_unit;
@@ -24,10 +47,11 @@ double Ne_unit, Thetae_unit;
 
 double R0, a, Q, hslope;
 double *neqpar;
+int neqpar_size;
 
 double stopx[4], startx[4], dx[4];
 double xprobmin[3], xprobmax[3];
-double **Xcoord, ***Xgrid, ***Xbar;
+double **Xcoord;
 
 int block_size, forest_size, cells, ndimini;
 int ng[3], *forest, *nx, nleafs;
@@ -37,6 +61,30 @@ int LFAC, XI;
 
 struct block *block_info;
 
+struct tree_node *tree;
+int *tree_root, tree_size, tree_nodes;
+
+// Emission mask, see CAN_EMIT, and whether any cell of a block can emit
+unsigned char *emit_mask, *block_emits;
+int mask_bytes;
+
+#if (OUT_OF_CORE)
+// Bounded LRU cache of converted blocks, filled on demand from the snapshot
+struct block_cache_slot *block_cache;
+int *block_cache_index; // slot of every block, -1 if not resident
+int block_cache_slots, block_cache_fd, block_cache_float;
+int64_t block_cache_offset;
+long block_cache_clock;
+int64_t block_cache_hits, block_cache_misses;
+omp_lock_t block_cache_lock;
+omp_lock_t *block_cache_loading; // held by the thread reading into a slot
+
+// Block pinned by each thread, kept until the thread moves to another block
+int block_pinned = -1;
+double *block_pinned_prims;
+#pragma omp threadprivate(block_pinned, block_pinned_prims)
+#endif
+
 // FUNCTIONS
 ////////////
 
@@ -50,10 +98,24 @@ void init_model() {
     // Initialize the BHAC AMR GRMHD data
     fprintf(stderr, "\nStarting read in of BHAC GRMHD data...\n");
 
+#if (SNAPSHOT || OUT_OF_CORE)
+    if (snapshot_load(GRMHD_FILE))
+        return;
+#endif
+
     init_grmhd_data(GRMHD_FILE);
+
+#if (OUT_OF_CORE)
+    // The dump was streamed into a snapshot, serve the blocks from there
+    char filename[512];
+    sprintf(filename, "%s%s", GRMHD_FILE, SNAPSHOT_SUFFIX);
+    block_cache_init(filename);
+#elif (SNAPSHOT)
+    snapshot_save(GRMHD_FILE);
+#endif
 }
 
-int find_igrid(double x[4], struct block *block_info, double ***Xc) {
+int find_igrid(double x[4], struct block *block_info) {
     double small = 1e-9;
 
 #if (metric == MKSBHAC || metric == MKSN)
@@ -70,26 +132,37 @@ int find_igrid(double x[4], struct block *block_info, double ***Xc) {
     if (x[2] > M_PI / 2.)
         small = -small;
 
-    for (int igrid = 0; igrid < nleafs; igrid++) {
-        if (x[1] + small >= block_info[igrid].lb[0] &&
-            x[1] + small <
-                block_info[igrid].lb[0] + (block_info[igrid].size[0]) *
-                                              block_info[igrid].dxc_block[0] &&
-            x[2] + small >= block_info[igrid].lb[1] &&
-            x[2] + small <
-                block_info[igrid].lb[1] + (block_info[igrid].size[1]) *
-                                              block_info[igrid].dxc_block[1] &&
-            x[3] + small >= block_info[igrid].lb[2] &&
-            x[3] + small <
-                block_info[igrid].lb[2] + (block_info[igrid].size[2]) *
-                                              block_info[igrid].dxc_block[2]) {
-            return igrid;
+    // position in units of the level one block size
+    double xs[3];
+    int ind[3] = {0, 0, 0};
+    for (int n = 0; n < ndimini; n++) {
+        xs[n] = (x[n + 1] + small - xprobmin[n]) /
+                ((xprobmax[n] - xprobmin[n]) / ng[n]);
+        if (xs[n] < 0. || xs[n] >= ng[n])
+            return -1;
+        ind[n] = (int)xs[n];
+    }
+
+    // walk down the forest from the level one block, the child slot is set by
+    // the lowest bit of the block index on the next level
+    int node = tree_root[ind[0] + ng[0] * (ind[1] + ng[1] * ind[2])];
+    double scale = 1.;
+    while (tree[node].igrid == -1) {
+        scale *= 2.;
+        int ich = 0;
+        for (int n = 0; n < ndimini; n++) {
+            ich += (((int)(xs[n] * scale)) & 1) << n;
         }
+        node = tree[node].child[ich];
     }
-    return -1;
+
+    if (tree[node].igrid == CROPPED_BLOCK)
+        return -1;
+
+    return tree[node].igrid;
 }
 
-int find_cell(double x[4], struct block *block_info, int igrid, double ***Xc) {
+int find_cell(double x[4], struct block *block_info, int igrid) {
 
     int i = (int)((x[1] - block_info[igrid].lb[0]) /
                   block_info[igrid].dxc_block[0]);
@@ -133,8 +206,21 @@ void new_index(int dims, int i, int *new_i, int *new_j, int *new_k, int ip,
     }
 }
 
+int new_tree_node() {
+    if (tree_nodes == tree_size) {
+        tree_size = 2 * tree_size + 1;
+        tree = (struct tree_node *)realloc(tree,
+                                           tree_size * sizeof(struct tree_node));
+    }
+    tree[tree_nodes].igrid = -1;
+    for (int ich = 0; ich < 8; ich++)
+        tree[tree_nodes].child[ich] = -1;
+
+    return tree_nodes++;
+}
+
 void read_node(FILE *file_id, int *igrid, int *refine, int ndimini, int level,
-               int ind_i, int ind_j, int ind_k) {
+               int ind_i, int ind_j, int ind_k, int node) {
     int buffer_i[1], leaf;
     fread(buffer_i, sizeof(int), 1, file_id);
     leaf = buffer_i[0];
@@ -158,6 +244,8 @@ void read_node(FILE *file_id, int *igrid, int *refine, int ndimini, int level,
         block_info[block_size - 1].ind[1] = ind_j;
         block_info[block_size - 1].ind[2] = ind_k;
         block_info[block_size - 1].level = level;
+
+        tree[node].igrid = block_size - 1;
     } else {
         (*refine) += 1;
         int i = (*igrid) + (*refine);
@@ -173,21 +261,55 @@ void read_node(FILE *file_id, int *igrid, int *refine, int ndimini, int level,
             int cind_j, cind_i, cind_k;
             new_index(ndimini, ich, &cind_i, &cind_j, &cind_k, ind_i, ind_j,
                       ind_k);
+            // new_tree_node can move the tree, so store by index only
+            int child = new_tree_node();
+            tree[node].child[ich] = child;
             read_node(file_id, igrid, refine, ndimini, level + 1, cind_i,
-                      cind_j, cind_k);
+                      cind_j, cind_k, child);
         }
     }
 }
 
+// Returns sqrt(det(gamma)) of the spatial metric, in closed form for the
+// Kerr-Schild type metrics so loading does not need a full metric_dd
 double get_detgamma(double x, double y, double z) {
 
-    double g_dd[4][4];
-    double X_u[4];
+#if (metric == MKSBHAC || metric == MKSN)
+    // Kerr-Schild form: det(gamma) = Sigma^2 sin^2(theta) / alpha^2 with
+    // 1 / alpha^2 = 1 + rho, times the Jacobian of the modified coordinates
+#if (metric == MKSBHAC)
+    double r = exp(x);
+    double theta = y + 0.5 * hslope * sin(2. * y);
+    double jac = r * (1. + hslope * cos(2. * y));
+    double Sigma = r * r + a * a * cos(theta) * cos(theta);
+    double rho = 2. * r / Sigma;
+#else
+    double r = exp(x) + R0;
+    double theta = y;
+    double jac = r - R0;
+    double Sigma = r * r + a * a * cos(theta) * cos(theta);
+    double rho = (2 * r - Q * Q) / Sigma + 1e-10;
+#endif
+    double detgamma =
+        Sigma * Sigma * sin(theta) * sin(theta) * (1. + rho) * jac * jac;
+
+#elif (metric == CKS)
+    // gamma_ij = delta_ij + f l_i l_j, so det(gamma) = 1 + f l.l
+    double R2 = x * x + y * y + z * z;
+    double a2 = a * a;
+    double r2 = (R2 - a2 + sqrt((R2 - a2) * (R2 - a2) + 4. * a2 * z * z)) * 0.5;
+    double r = sqrt(r2);
+    double sig = r2 * r2 + a2 * z * z;
+    double isig = (r < 1) ? 1 / (sig + 1e-3) : 1 / sig;
+    double f = 2. * r2 * r * isig;
+    double l1 = (r * x + a * y) / (r2 + a2);
+    double l2 = (r * y - a * x) / (r2 + a2);
+    double l3 = z / (r + 1e-3);
+    double detgamma = 1. + f * (l1 * l1 + l2 * l2 + l3 * l3);
 
-    X_u[0] = 0;
-    X_u[1] = x;
-    X_u[2] = y;
-    X_u[3] = z;
+#else
+    double g_dd[4][4];
+    double X_u[4] = {0., x, y, z};
 
     metric_dd(X_u, g_dd);
 
@@ -195,6 +317,7 @@ double get_detgamma(double x, double y, double z) {
         g_dd[1][1] * (g_dd[2][2] * g_dd[3][3] - g_dd[3][2] * g_dd[2][3]) -
         g_dd[1][2] * (g_dd[2][1] * g_dd[3][3] - g_dd[3][1] * g_dd[2][3]) +
         g_dd[1][3] * (g_dd[2][1] * g_dd[3][2] - g_dd[2][2] * g_dd[3][1]);
+#endif
 
 #if (DEBUG)
     if (isnan(sqrt(detgamma))) {
@@ -589,6 +712,7 @@ void init_grmhd_data(char *fname) {
     offset = offset - (ndimini * 4 + neqparini * 8);
     fseek(file_id, offset, SEEK_CUR);
 
+    neqpar_size = neqparini;
     neqpar = (double *)malloc(neqparini * sizeof(double));
     nx = (int *)malloc(ndimini * sizeof(int));
 
@@ -696,6 +820,13 @@ void init_grmhd_data(char *fname) {
     block_info = (struct block *)malloc(0);
 
     forest = (int *)malloc(sizeof(int));
+
+    tree = NULL;
+    tree_size = 0;
+    tree_nodes = 0;
+    tree_root = (int *)malloc(ng[0] * ng[1] * ng[2] * sizeof(int));
+    for (int n = 0; n < ng[0] * ng[1] * ng[2]; n++)
+        tree_root[n] = new_tree_node();
     fprintf(stderr, ".");
 
     int level = 1;
@@ -723,7 +854,8 @@ void init_grmhd_data(char *fname) {
         j = sfc_iglevel1[sfc_i][1];
         k = sfc_iglevel1[sfc_i][2];
 
-        read_node(file_id, &igrid, &refine, ndimini, level, i, j, k);
+        read_node(file_id, &igrid, &refine, ndimini, level, i, j, k,
+                  tree_root[i + ng[0] * (j + ng[1] * k)]);
     }
 
 #else
@@ -731,7 +863,8 @@ void init_grmhd_data(char *fname) {
         for (int j = 0; j < ng[1]; j++) {
             for (int i = 0; i < ng[0]; i++) {
 
-                read_node(file_id, &igrid, &refine, ndimini, level, i, j, k);
+                read_node(file_id, &igrid, &refine, ndimini, level, i, j, k,
+                          tree_root[i + ng[0] * (j + ng[1] * k)]);
             }
         }
     }
@@ -750,29 +883,6 @@ void init_grmhd_data(char *fname) {
         dxc[i] = (xprobmax[i] - xprobmin[i]) / nxlone[i];
     }
 
-    double **values;
-    values = (double **)malloc(nwini * sizeof(double *));
-    for (int i = 0; i < nwini; i++) {
-        values[i] = (double *)malloc(cells * sizeof(double));
-    }
-
-    Xgrid = (double ***)malloc(nleafs * sizeof(double **));
-    Xbar = (double ***)malloc(nleafs * sizeof(double **));
-    for (int j = 0; j < nleafs; j++) {
-        Xgrid[j] = (double **)malloc(cells * sizeof(double *));
-        Xbar[j] = (double **)malloc(cells * sizeof(double *));
-        for (int i = 0; i < cells; i++) {
-            Xgrid[j][i] = (double *)malloc(ndimini * sizeof(double));
-            Xbar[j][i] = (double *)malloc(ndimini * sizeof(double));
-        }
-    }
-
-    init_storage();
-
-    fprintf(stderr, ".");
-
-    fseek(file_id, 0, SEEK_SET);
-
     for (int i = 0; i < nleafs; i++) {
         for (int n = 0; n < ndimini; n++) {
             block_info[i].lb[n] =
@@ -789,59 +899,759 @@ void init_grmhd_data(char *fname) {
                 (dxc[n] / (pow(2., (double)block_info[i].level - 1.)));
             block_info[i].size[n] = nx[n];
         }
+    }
 
-        for (int nw = 0; nw < nwini; nw++) {
-            for (int c = 0; c < cells; c++) {
-                fread(buffer, sizeof(double), 1, file_id);
-                values[nw][c] = buffer[0];
+    // Blocks are read from the dump in their original order, block_dest
+    // holds where each one is stored or -1 if it was cropped
+    int dump_leafs = nleafs;
+    int *block_dest = (int *)malloc(dump_leafs * sizeof(int));
+    for (int i = 0; i < dump_leafs; i++)
+        block_dest[i] = i;
+#if (EMISSION_MASK)
+    crop_blocks(block_dest);
+    mask_bytes = (cells + 7) / 8;
+    emit_mask = (unsigned char *)calloc((size_t)nleafs * mask_bytes, 1);
+    block_emits = (unsigned char *)calloc(nleafs, 1);
+#endif
+
+    fprintf(stderr, ".");
+
+    // Every block stores nwini x cells conserved variables followed by the
+    // staggered fields, which are not used
+    size_t block_bytes = (size_t)cells * nwini * sizeof(double);
+    size_t stag_bytes = (size_t)(nx[0] + 1) * (nx[1] + 1) * (nx[2] + 1) * nws *
+                        sizeof(double);
+    size_t stride = block_bytes + stag_bytes;
+    size_t data_bytes = (size_t)dump_leafs * stride;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    // Blocks are converted in chunks of about 256 MB, all cells of a chunk
+    // are shared out over the threads at once
+    int chunk_blocks = (256 << 20) / stride;
+    if (chunk_blocks < 1)
+        chunk_blocks = 1;
+
+    // Map the data section of the snapshot so blocks are converted straight
+    // from the page cache, fall back to one buffered read per block
+    char *map = mmap(NULL, data_bytes, PROT_READ, MAP_PRIVATE,
+                     fileno(file_id), 0);
+#if (OUT_OF_CORE)
+    // Converted chunks go straight to the snapshot, only one chunk of
+    // primitives is held in memory
+    FILE *snapshot = snapshot_create(fname);
+    double *chunk_prims =
+        (double *)malloc((size_t)chunk_blocks * cells * NPRIM * sizeof(double));
+    if (snapshot == NULL || chunk_prims == NULL) {
+        fprintf(stderr, "Out-of-core mode needs a writable snapshot\n");
+        exit(1);
+    }
+    size_t prims_written = 0;
+#else
+    init_storage();
+#endif
+
+    char *chunk_buffer = NULL;
+    if (map == MAP_FAILED) {
+        map = NULL;
+        chunk_buffer = (char *)malloc(chunk_blocks * stride);
+        fseek(file_id, 0, SEEK_SET);
+    } else {
+        posix_madvise(map, data_bytes, POSIX_MADV_SEQUENTIAL);
+    }
+
+    double read_start = omp_get_wtime();
+
+    // Number of blocks stored so far, the kept blocks of a chunk are stored
+    // one after the other from here
+    int stored = 0;
+
+    for (int first = 0; first < dump_leafs; first += chunk_blocks) {
+        int n_blocks = chunk_blocks;
+        if (first + n_blocks > dump_leafs)
+            n_blocks = dump_leafs - first;
+
+        int kept = 0;
+        for (int b = 0; b < n_blocks; b++)
+            kept += (block_dest[first + b] >= 0);
+
+        char *chunk;
+        if (map) {
+            chunk = map + first * stride;
+
+            // Have the kernel fetch the next chunk while this one converts
+            if (first + n_blocks < dump_leafs) {
+                size_t next = (first + n_blocks) * stride;
+                size_t aligned = next - next % page;
+                posix_madvise(map + aligned,
+                              chunk_blocks * stride + next - aligned,
+                              POSIX_MADV_WILLNEED);
             }
+        } else {
+            for (int b = 0; b < n_blocks; b++) {
+                if (block_dest[first + b] < 0) {
+                    fseek(file_id, stride, SEEK_CUR);
+                    continue;
+                }
+                if (fread(chunk_buffer + b * stride, 1, block_bytes,
+                          file_id) != block_bytes) {
+                    fprintf(stderr, "\nCan't read block %d of %s... Abort!\n",
+                            first + b, fname);
+                    exit(1234);
+                }
+                fseek(file_id, stag_bytes, SEEK_CUR);
+            }
+            chunk = chunk_buffer;
         }
 
-#pragma omp parallel for shared(values, p) schedule(static, 1)
-        for (int c = 0; c < cells; c++) {
-            calc_coord(c, nx, ndimini, block_info[i].lb,
-                       block_info[i].dxc_block, Xgrid[i][c]);
-            double X_u[4] = {0, Xgrid[i][c][0], Xgrid[i][c][1], Xgrid[i][c][2]};
-            double r = get_r(X_u);
-            if (r > 1.0) {
+#if (OUT_OF_CORE)
+        double *prims = chunk_prims;
+        memset(prims, 0, (size_t)kept * cells * NPRIM * sizeof(double));
+#else
+        double *prims = &PRIM(stored, 0, 0);
+#endif
 
-                calc_coord_bar(Xgrid[i][c], block_info[i].dxc_block,
-                               Xbar[i][c]);
+#pragma omp parallel for collapse(2) schedule(dynamic, 64)
+        for (int b = 0; b < n_blocks; b++) {
+            for (int c = 0; c < cells; c++) {
+                int i = block_dest[first + b];
+                if (i < 0)
+                    continue;
+                double *block_data = (double *)(chunk + b * stride);
+                double *values[nwini];
+                for (int nw = 0; nw < nwini; nw++)
+                    values[nw] = block_data + (size_t)nw * cells;
+
+                // Cell centre and its barycentre, only needed here
+                double Xgrid[3] = {0., 0., 0.}, Xbar[3];
+                calc_coord(c, nx, ndimini, block_info[i].lb,
+                           block_info[i].dxc_block, Xgrid);
+                double X_u[4] = {0, Xgrid[0], Xgrid[1], Xgrid[2]};
+                double r = get_r(X_u);
+                if (r > 1.0) {
+
+                    calc_coord_bar(Xgrid, block_info[i].dxc_block, Xbar);
 
 #if (DEBUG)
-                if (isnan(Xgrid[i][c][0])) {
-                    fprintf(stderr, "%d %d", c, i);
-                    exit(1);
+                    if (isnan(Xgrid[0])) {
+                        fprintf(stderr, "%d %d", c, i);
+                        exit(1);
+                    }
+#endif
+                    double prim[8];
+                    convert2prim(prim, values, c, Xbar, Xgrid,
+                                 block_info[i].dxc_block);
+
+                    for (int q = 0; q < NPRIM; q++)
+                        prims[((size_t)(i - stored) * cells + c) * NPRIM +
+                              q] = prim[q];
                 }
+                if (i == (nleafs / 2) && c == 0)
+                    fprintf(stderr, ".");
+            }
+        }
+
+#if (EMISSION_MASK)
+#pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < kept; b++)
+            build_emission_mask(stored + b,
+                                prims + (size_t)b * cells * NPRIM);
+#endif
+
+#if (OUT_OF_CORE)
+        prims_written +=
+            snapshot_write_prims(snapshot, prims, (size_t)kept * cells * NPRIM);
+#endif
+        stored += kept;
+    }
+
+    double read_time = omp_get_wtime() - read_start;
+    fprintf(stderr, "Done\n");
+    fprintf(stderr, "Read and converted %.2f GB in %.1f s (%.2f GB/s, %s)\n",
+            nleafs * block_bytes / 1e9, read_time,
+            nleafs * block_bytes / 1e9 / read_time, map ? "mmap" : "fread");
+
+    if (map)
+        munmap(map, data_bytes);
+    free(chunk_buffer);
+    free(block_dest);
+#if (OUT_OF_CORE)
+    free(chunk_prims);
+#if (EMISSION_MASK)
+    fwrite(emit_mask, 1, (size_t)nleafs * mask_bytes, snapshot);
+#endif
+    if (fclose(snapshot) != 0 ||
+        prims_written != (size_t)nleafs * cells * NPRIM) {
+        fprintf(stderr, "Writing the snapshot of %s failed\n", fname);
+        exit(1);
+    }
 #endif
-                double prim[8];
-                convert2prim(prim, values, c, Xbar[i][c], Xgrid[i][c],
-                             block_info[i].dxc_block);
+    free(forest);
+}
+
+#if (EMISSION_MASK)
+// Lower bound of the radius within block igrid
+double block_r_min(int igrid) {
+#if (metric == CKS)
+    // Closest point of the block to the origin, with r^2 >= R^2 - a^2
+    double R2 = 0.;
+    for (int n = 0; n < 3; n++) {
+        double lo = block_info[igrid].lb[n];
+        double hi = lo + block_info[igrid].size[n] *
+                             block_info[igrid].dxc_block[n];
+        double d = (lo > 0.) ? lo : ((hi < 0.) ? -hi : 0.);
+        R2 += d * d;
+    }
+    return sqrt(fmax(R2 - a * a, 0.));
+#else
+    double X_u[4] = {0., block_info[igrid].lb[0], block_info[igrid].lb[1],
+                     block_info[igrid].lb[2]};
+    return get_r(X_u);
+#endif
+}
+
+// Drops the blocks that lie entirely beyond RT_OUTER_CUTOFF, where nothing is
+// sampled. block_dest is set to the new index of every block, or -1.
+void crop_blocks(int *block_dest) {
+    int dump_leafs = nleafs;
+
+    nleafs = 0;
+    for (int i = 0; i < dump_leafs; i++) {
+        if (block_r_min(i) > RT_OUTER_CUTOFF) {
+            block_dest[i] = -1;
+        } else {
+            block_info[nleafs] = block_info[i];
+            block_dest[i] = nleafs++;
+        }
+    }
+    N1 = nleafs;
 
-                p[KRHO][i][c][0] = prim[KRHO];
-                p[UU][i][c][0] = prim[UU];
+    for (int n = 0; n < tree_nodes; n++) {
+        if (tree[n].igrid >= 0) {
+            int dest = block_dest[tree[n].igrid];
+            tree[n].igrid = (dest >= 0) ? dest : CROPPED_BLOCK;
+        }
+    }
+
+    fprintf(stderr, "\nCropped %d of %d blocks beyond r = %g\n",
+            dump_leafs - nleafs, dump_leafs, RT_OUTER_CUTOFF);
+}
+
+// Whether the interpolation stencil with the given corner cells can emit,
+// which is when one of its corners can or a field component changes sign over
+// it, as interpolation then cancels the field and lowers sigma below that of
+// the corners
+int stencil_can_emit(unsigned char *emits, double *prims, size_t corner[8]) {
+    for (int n = 0; n < 8; n++)
+        if (emits[corner[n]])
+            return 1;
+
+    for (int q = B1; q <= B3; q++) {
+        int pos = 0, neg = 0;
+        for (int n = 0; n < 8; n++) {
+            pos |= (prims[corner[n] * NPRIM + q] > 0.);
+            neg |= (prims[corner[n] * NPRIM + q] < 0.);
+        }
+        if (pos && neg)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Sets the emission mask of block igrid from its primitives. A cell can emit
+// if it lies within RT_OUTER_CUTOFF and its sigma is below MASK_SIGMA_MARGIN
+// times SIGMA_CUT, and the mask of a cell is set if its interpolation stencil
+// can emit.
+// The electron temperature cuts depend on R_HIGH and R_LOW, so those are left
+// to the samples.
+void build_emission_mask(int igrid, double *prims) {
+    unsigned char *emits = (unsigned char *)malloc(cells);
+
+    for (int c = 0; c < cells; c++) {
+        double Xgrid[3] = {0., 0., 0.};
+        calc_coord(c, nx, ndimini, block_info[igrid].lb,
+                   block_info[igrid].dxc_block, Xgrid);
+        double X_u[4] = {0, Xgrid[0], Xgrid[1], Xgrid[2]};
+        double r = get_r(X_u);
+        emits[c] = 0;
+        if (r > 1.0 && r <= RT_OUTER_CUTOFF) {
+            struct GRMHD modvar;
+            fluid_params_from_prims(X_u, prims + (size_t)c * NPRIM, &modvar);
+            emits[c] = !(modvar.sigma > MASK_SIGMA_MARGIN * SIGMA_CUT);
+        }
+    }
+
+    unsigned char *mask = emit_mask + (size_t)igrid * mask_bytes;
+    for (int c = 0; c < cells; c++) {
+        int c_i = c % nx[0];
+        int c_j = (c / nx[0]) % nx[1];
+        int c_k = (ndimini == 3) ? c / (nx[0] * nx[1]) : 0;
+        int c_ip = (c_i + 1 < nx[0]) ? c_i + 1 : c_i;
+        int c_jp = (c_j + 1 < nx[1]) ? c_j + 1 : c_j;
+        int c_kp = (ndimini == 3 && c_k + 1 < nx[2]) ? c_k + 1 : c_k;
+
+        size_t corner[8] = {
+            compute_c(c_i, c_j, c_k),   compute_c(c_i, c_jp, c_k),
+            compute_c(c_ip, c_j, c_k),  compute_c(c_ip, c_jp, c_k),
+            compute_c(c_i, c_j, c_kp),  compute_c(c_i, c_jp, c_kp),
+            compute_c(c_ip, c_j, c_kp), compute_c(c_ip, c_jp, c_kp)};
+
+        if (stencil_can_emit(emits, prims, corner)) {
+            mask[c >> 3] |= 1 << (c & 7);
+            block_emits[igrid] = 1;
+        }
+    }
+
+    free(emits);
+}
+#endif
 
-                p[U1][i][c][0] = prim[U1];
-                p[U2][i][c][0] = prim[U2];
-                p[U3][i][c][0] = prim[U3];
+#if (SKIP_EMPTY_BLOCKS)
+// Affine parameter distance from X_u to the boundary of block igrid along a
+// ray with wave vector U_u, in a straight line
+double block_exit_step(double X_u[4], double U_u[4], int igrid) {
+    double exit_step = 1e100;
+
+    for (int n = 0; n < 3; n++) {
+        double lo = block_info[igrid].lb[n];
+        double hi = lo + block_info[igrid].size[n] *
+                             block_info[igrid].dxc_block[n];
+        // Rays are traced back from the camera, dlambda < 0
+        double v = -U_u[n + 1];
+        if (v > 0.)
+            exit_step = fmin(exit_step, (hi - X_u[n + 1]) / v);
+        else if (v < 0.)
+            exit_step = fmin(exit_step, (lo - X_u[n + 1]) / v);
+    }
+
+    return fmax(exit_step, 0.);
+}
+#endif
 
-                p[B1][i][c][0] = prim[B1];
-                p[B2][i][c][0] = prim[B2];
-                p[B3][i][c][0] = prim[B3];
+// FNV-1a hash of the loaded AMR block layout. The geodesic step size follows
+// the block resolution, so stored lightpaths are only valid on this layout.
+uint64_t block_layout_hash() {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int igrid = 0; igrid < nleafs; igrid++) {
+        struct block *b = &block_info[igrid];
+        const void *fields[5] = {b->ind, &b->level, b->size, b->lb,
+                                 b->dxc_block};
+        size_t sizes[5] = {sizeof(b->ind), sizeof(b->level), sizeof(b->size),
+                           sizeof(b->lb), sizeof(b->dxc_block)};
+        for (int n = 0; n < 5; n++) {
+            const unsigned char *bytes = fields[n];
+            for (size_t i = 0; i < sizes[n]; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
             }
-            if (i == (nleafs / 2) && c == 0)
-                fprintf(stderr, ".");
         }
-#pragma omp barrier
+    }
+    return hash;
+}
+
+// Fills the key of a preprocessed snapshot, which ties it to the dump and
+// grid file it was made from
+void snapshot_fill_key(struct snapshot_header *header, char *fname) {
+    struct stat st;
+
+    memset(header, 0, sizeof(struct snapshot_header));
+    memcpy(header->magic, "RAPTORPS", 8);
+    header->version = 2;
+    header->metric_id = metric;
+    header->prim_float = SNAPSHOT_FLOAT;
+    header->emission_mask = EMISSION_MASK;
+#if (EMISSION_MASK)
+    header->rt_outer_cutoff = RT_OUTER_CUTOFF;
+    header->sigma_cut = MASK_SIGMA_MARGIN * SIGMA_CUT;
+#endif
 
-        offset = (nx[0] + 1) * (nx[1] + 1) * (nx[2] + 1) * nws * 8;
-        fseek(file_id, offset, SEEK_CUR);
+    if (stat(fname, &st) == 0) {
+        header->dump_size = st.st_size;
+        header->dump_mtime = st.st_mtime;
     }
-    fprintf(stderr, "Done\n");
-    free(values);
-    free(forest);
+    if (stat(metric == CKS ? "grid_cks.in" : "grid_mks.in", &st) == 0) {
+        header->grid_size = st.st_size;
+        header->grid_mtime = st.st_mtime;
+    }
+}
+
+// Loads the converted primitives and block tree of a dump from its
+// preprocessed snapshot, returns 0 if there is no matching snapshot.
+// Double precision primitives are used straight from the mapped file.
+int snapshot_load(char *fname) {
+    char filename[512];
+    sprintf(filename, "%s%s", fname, SNAPSHOT_SUFFIX);
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+
+    struct stat st;
+    fstat(fileno(file), &st);
+    size_t map_size = st.st_size;
+    char *map = NULL;
+    if (map_size >= sizeof(struct snapshot_header)) {
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (map == MAP_FAILED)
+            map = NULL;
+    }
+    fclose(file);
+    if (map == NULL)
+        return 0;
+
+    struct snapshot_header key;
+    snapshot_fill_key(&key, fname);
+    struct snapshot_header *header = (struct snapshot_header *)map;
+    if (memcmp(header, &key, offsetof(struct snapshot_header, nleafs)) != 0) {
+        fprintf(stderr,
+                "Snapshot %s was made from a different dump or grid, "
+                "converting the dump again\n",
+                filename);
+        munmap(map, map_size);
+        return 0;
+    }
+    size_t end = header->mask_offset;
+    if (header->emission_mask)
+        end += (size_t)header->nleafs * ((header->cells + 7) / 8);
+    if (end > map_size) {
+        fprintf(stderr, "Snapshot %s is truncated, converting the dump again\n",
+                filename);
+        munmap(map, map_size);
+        return 0;
+    }
+
+    double load_start = omp_get_wtime();
+
+    nleafs = header->nleafs;
+    ndimini = header->ndimini;
+    cells = header->cells;
+    nx = (int *)malloc(3 * sizeof(int));
+    for (int n = 0; n < 3; n++) {
+        nx[n] = header->nx[n];
+        ng[n] = header->ng[n];
+        xprobmin[n] = header->xprobmin[n];
+        xprobmax[n] = header->xprobmax[n];
+        startx[n + 1] = xprobmin[n];
+        stopx[n + 1] = xprobmax[n];
+    }
+    hslope = header->hslope;
+    N1 = nleafs;
+    N2 = cells;
+    N3 = 1;
+
+    char *data = map + sizeof(struct snapshot_header);
+
+    neqpar_size = header->neqpar;
+    neqpar = (double *)malloc(neqpar_size * sizeof(double));
+    memcpy(neqpar, data, neqpar_size * sizeof(double));
+    data += neqpar_size * sizeof(double);
+    a = neqpar[NSPIN];
+    Q = 0.0;
+
+    block_info = (struct block *)malloc(nleafs * sizeof(struct block));
+    memcpy(block_info, data, nleafs * sizeof(struct block));
+    data += nleafs * sizeof(struct block);
+
+    tree_nodes = header->tree_nodes;
+    tree_size = tree_nodes;
+    tree = (struct tree_node *)malloc(tree_nodes * sizeof(struct tree_node));
+    memcpy(tree, data, tree_nodes * sizeof(struct tree_node));
+    data += tree_nodes * sizeof(struct tree_node);
+
+    int roots = ng[0] * ng[1] * ng[2];
+    tree_root = (int *)malloc(roots * sizeof(int));
+    memcpy(tree_root, data, roots * sizeof(int));
+
+#if (EMISSION_MASK)
+    mask_bytes = (cells + 7) / 8;
+    size_t mask_size = (size_t)nleafs * mask_bytes;
+    emit_mask = (unsigned char *)malloc(mask_size);
+    memcpy(emit_mask, map + header->mask_offset, mask_size);
+    block_emits = (unsigned char *)calloc(nleafs, 1);
+    for (size_t n = 0; n < mask_size; n++)
+        if (emit_mask[n])
+            block_emits[n / mask_bytes] = 1;
+#endif
+
+    size_t size = (size_t)nleafs * cells * NPRIM;
+#if (OUT_OF_CORE)
+    (void)size;
+    munmap(map, map_size);
+    block_cache_init(filename);
+#else
+    if (header->prim_float) {
+        float *prims = (float *)(map + header->data_offset);
+        init_storage();
+#pragma omp parallel for schedule(static)
+        for (size_t n = 0; n < size; n++)
+            p[n] = prims[n];
+        munmap(map, map_size);
+    } else {
+        // The mapping stays alive for the rest of the run
+        p = (double *)(map + header->data_offset);
+    }
+#endif
+
+    fprintf(stderr, "Loaded preprocessed snapshot %s in %.1f s\n", filename,
+            omp_get_wtime() - load_start);
+
+    return 1;
 }
 
+// Creates the snapshot of a dump and writes its header and block tree, the
+// primitives follow with snapshot_write_prims. Returns NULL on failure.
+FILE *snapshot_create(char *fname) {
+    char filename[512];
+    sprintf(filename, "%s%s", fname, SNAPSHOT_SUFFIX);
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write snapshot %s\n", filename);
+        return NULL;
+    }
+
+    struct snapshot_header header;
+    snapshot_fill_key(&header, fname);
+    header.nleafs = nleafs;
+    header.ndimini = ndimini;
+    header.cells = cells;
+    for (int n = 0; n < 3; n++) {
+        header.nx[n] = (n < ndimini) ? nx[n] : 1;
+        header.ng[n] = ng[n];
+        header.xprobmin[n] = xprobmin[n];
+        header.xprobmax[n] = xprobmax[n];
+    }
+    header.hslope = hslope;
+    header.neqpar = neqpar_size;
+    header.tree_nodes = tree_nodes;
+
+    int roots = ng[0] * ng[1] * ng[2];
+    size_t meta_bytes = sizeof(struct snapshot_header) +
+                        neqpar_size * sizeof(double) +
+                        nleafs * sizeof(struct block) +
+                        tree_nodes * sizeof(struct tree_node) +
+                        roots * sizeof(int);
+
+    // Start the primitives on a page boundary so they can be mapped as is
+    size_t page = sysconf(_SC_PAGESIZE);
+    header.data_offset = (meta_bytes + page - 1) / page * page;
+    // The emission mask follows the primitives
+    header.mask_offset = header.data_offset + (size_t)nleafs * cells * NPRIM *
+                                                  (SNAPSHOT_FLOAT ? 4 : 8);
+
+    fwrite(&header, sizeof(struct snapshot_header), 1, file);
+    fwrite(neqpar, sizeof(double), neqpar_size, file);
+    fwrite(block_info, sizeof(struct block), nleafs, file);
+    fwrite(tree, sizeof(struct tree_node), tree_nodes, file);
+    fwrite(tree_root, sizeof(int), roots, file);
+    for (size_t n = meta_bytes; n < (size_t)header.data_offset; n++)
+        fputc(0, file);
+
+    return file;
+}
+
+// Appends size primitives to a snapshot in its storage precision, returns
+// the number written
+size_t snapshot_write_prims(FILE *file, double *prims, size_t size) {
+    if (!SNAPSHOT_FLOAT)
+        return fwrite(prims, sizeof(double), size, file);
+
+    size_t chunk = 1 << 20;
+    float *buffer = (float *)malloc(chunk * sizeof(float));
+    size_t written = 0;
+    for (size_t first = 0; first < size; first += chunk) {
+        size_t n = (size - first < chunk) ? size - first : chunk;
+        for (size_t q = 0; q < n; q++)
+            buffer[q] = prims[first + q];
+        written += fwrite(buffer, sizeof(float), n, file);
+    }
+    free(buffer);
+    return written;
+}
+
+// Stores the converted primitives and block tree of a dump, so later runs on
+// the same dump can skip reading and converting it
+void snapshot_save(char *fname) {
+    char filename[512];
+    sprintf(filename, "%s%s", fname, SNAPSHOT_SUFFIX);
+
+    FILE *file = snapshot_create(fname);
+    if (file == NULL)
+        return;
+
+    size_t size = (size_t)nleafs * cells * NPRIM;
+    size_t written = snapshot_write_prims(file, p, size);
+#if (EMISSION_MASK)
+    size_t mask_size = (size_t)nleafs * mask_bytes;
+    if (fwrite(emit_mask, 1, mask_size, file) != mask_size)
+        written = 0;
+#endif
+
+    if (fclose(file) != 0 || written != size) {
+        fprintf(stderr, "Writing snapshot %s failed, removing it\n",
+                filename);
+        remove(filename);
+        return;
+    }
+
+    fprintf(stderr, "Stored preprocessed snapshot %s\n", filename);
+}
+
+#if (OUT_OF_CORE)
+// Opens the primitives of a snapshot for on-demand block loading, the cache
+// holds BLOCK_CACHE_MB of blocks but at least two per thread
+void block_cache_init(char *filename) {
+    block_cache_fd = open(filename, O_RDONLY);
+    struct snapshot_header header;
+    if (block_cache_fd < 0 ||
+        pread(block_cache_fd, &header, sizeof(struct snapshot_header), 0) !=
+            sizeof(struct snapshot_header)) {
+        fprintf(stderr, "Cannot open snapshot %s for out-of-core reads\n",
+                filename);
+        exit(1);
+    }
+    block_cache_offset = header.data_offset;
+    block_cache_float = header.prim_float;
+
+    size_t block_bytes = (size_t)cells * NPRIM * sizeof(double);
+    block_cache_slots = (size_t)BLOCK_CACHE_MB * 1024 * 1024 / block_bytes;
+    if (block_cache_slots < 2 * omp_get_max_threads())
+        block_cache_slots = 2 * omp_get_max_threads();
+    if (block_cache_slots > nleafs)
+        block_cache_slots = nleafs;
+
+    block_cache = (struct block_cache_slot *)malloc(
+        block_cache_slots * sizeof(struct block_cache_slot));
+    double *space = (double *)malloc(block_cache_slots * block_bytes);
+    if (block_cache == NULL || space == NULL) {
+        fprintf(stderr, "Cannot allocate the block cache\n");
+        exit(1);
+    }
+    block_cache_loading =
+        (omp_lock_t *)malloc(block_cache_slots * sizeof(omp_lock_t));
+    for (int slot = 0; slot < block_cache_slots; slot++) {
+        block_cache[slot].igrid = -1;
+        block_cache[slot].pins = 0;
+        block_cache[slot].loading = 0;
+        omp_init_lock(&block_cache_loading[slot]);
+        block_cache[slot].last_use = 0;
+        block_cache[slot].prims = space + (size_t)slot * cells * NPRIM;
+    }
+
+    block_cache_index = (int *)malloc(nleafs * sizeof(int));
+    for (int i = 0; i < nleafs; i++)
+        block_cache_index[i] = -1;
+
+    block_cache_clock = 0;
+    block_cache_hits = 0;
+    block_cache_misses = 0;
+    omp_init_lock(&block_cache_lock);
+    atexit(block_cache_report);
+
+    fprintf(stderr, "Out-of-core: caching %d of %d blocks (%.2f GB)\n",
+            block_cache_slots, nleafs, block_cache_slots * block_bytes / 1e9);
+}
+
+// Reads the primitives of block igrid from the snapshot into a cache slot
+void block_cache_read(int igrid, double *prims) {
+    size_t n = (size_t)cells * NPRIM;
+    size_t bytes = n * (block_cache_float ? sizeof(float) : sizeof(double));
+    off_t offset = block_cache_offset + (off_t)igrid * bytes;
+    char *target = block_cache_float ? (char *)malloc(bytes) : (char *)prims;
+
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t got =
+            pread(block_cache_fd, target + done, bytes - done, offset + done);
+        if (got <= 0) {
+            fprintf(stderr, "Out-of-core read of block %d failed\n", igrid);
+            exit(1);
+        }
+        done += got;
+    }
+
+    if (block_cache_float) {
+        float *values = (float *)target;
+        for (size_t q = 0; q < n; q++)
+            prims[q] = values[q];
+        free(target);
+    }
+}
+
+// Returns the primitives of block igrid, loading it if needed. The block
+// stays pinned for the calling thread until it asks for another block.
+// A missing block is read after the cache is unlocked, threads that ask for
+// it meanwhile wait on its slot only.
+double *block_prims(int igrid) {
+    if (igrid == block_pinned)
+        return block_pinned_prims;
+
+    omp_set_lock(&block_cache_lock);
+
+    if (block_pinned >= 0)
+        block_cache[block_cache_index[block_pinned]].pins--;
+
+    int slot = block_cache_index[igrid];
+    int load = (slot < 0);
+    if (!load) {
+        block_cache_hits++;
+    } else {
+        block_cache_misses++;
+
+        // Evict the least recently used block no thread is working on
+        slot = -1;
+        for (int s = 0; s < block_cache_slots; s++) {
+            if (block_cache[s].pins > 0)
+                continue;
+            if (slot < 0 ||
+                block_cache[s].last_use < block_cache[slot].last_use)
+                slot = s;
+        }
+        if (block_cache[slot].igrid >= 0)
+            block_cache_index[block_cache[slot].igrid] = -1;
+
+        // Reserve the slot, the block is read once the cache is unlocked
+        block_cache[slot].igrid = igrid;
+        block_cache[slot].loading = 1;
+        block_cache_index[igrid] = slot;
+        omp_set_lock(&block_cache_loading[slot]);
+    }
+    int wait = !load && block_cache[slot].loading;
+
+    block_cache[slot].pins++;
+    block_cache[slot].last_use = ++block_cache_clock;
+
+    omp_unset_lock(&block_cache_lock);
+
+    if (load) {
+        block_cache_read(igrid, block_cache[slot].prims);
+
+        omp_set_lock(&block_cache_lock);
+        block_cache[slot].loading = 0;
+        omp_unset_lock(&block_cache_lock);
+        omp_unset_lock(&block_cache_loading[slot]);
+    } else if (wait) {
+        // Another thread is still reading the block
+        omp_set_lock(&block_cache_loading[slot]);
+        omp_unset_lock(&block_cache_loading[slot]);
+    }
+
+    block_pinned = igrid;
+    block_pinned_prims = block_cache[slot].prims;
+    return block_pinned_prims;
+}
+
+void block_cache_report() {
+    int64_t requests = block_cache_hits + block_cache_misses;
+    fprintf(stderr,
+            "Out-of-core: %lld block requests, %.2f%% hits, %lld blocks "
+            "read\n",
+            (long long)requests,
+            requests ? 100. * block_cache_hits / requests : 0.,
+            (long long)block_cache_misses);
+}
+#endif
+
 void set_units(double M_unit_) {
 
     L_unit = GGRAV * MBH / (SPEED_OF_LIGHT * SPEED_OF_LIGHT);
@@ -854,17 +1664,15 @@ void set_units(double M_unit_) {
     Ne_unit = RHO_unit / (PROTON_MASS + ELECTRON_MASS);
 }
 
+// Allocates the primitives of all blocks as one contiguous array, ordered
+// [block][cell][prim] so the stencil of a cell holds all of its primitives
 void init_storage() {
-    int i;
-    p = (double ****)malloc(NPRIM * sizeof(double ***));
-    for (i = 0; i < NPRIM; i++) {
-        p[i] = (double ***)malloc((N1 + 1) * sizeof(double **));
-        for (int j = 0; j <= N1; j++) {
-            p[i][j] = (double **)malloc((N2 + 1) * sizeof(double *));
-            for (int k = 0; k <= N2; k++) {
-                p[i][j][k] = (double *)malloc((N3) * sizeof(double));
-            }
-        }
+    size_t size = (size_t)N1 * N2 * N3 * NPRIM;
+    p = (double *)calloc(size, sizeof(double));
+    if (p == NULL) {
+        fprintf(stderr, "Cannot allocate %g GB for the primitives\n",
+                size * sizeof(double) / 1e9);
+        exit(1);
     }
 
     return;
@@ -925,26 +1733,22 @@ int compute_c(int i, int j, int k) {
     return i + j * nx[0] + k * nx[0] * nx[1];
 }
 
-double interp_scalar(double **var, int c, double coeff[4]) {
-
-    double interp;
+// Interpolates all primitives of block igrid around cell c, the stencil is
+// built once and shared by the fields
+void interp_prims(int igrid, int c, double del[4], double prim[NPRIM]) {
     int c_ip, c_jp, c_kp;
     int c_i, c_j, c_k = 0;
-    double b1, b2, b3, del[NDIM];
-    int cindex[2][2][2];
+    double *corner[8];
 
-    del[1] = coeff[1];
-    del[2] = coeff[2];
-    del[3] = coeff[3];
     if (del[1] > 1 || del[2] > 1 || del[3] > 1 || del[1] < 0 || del[2] < 0 ||
         del[3] < 0)
         fprintf(stderr, "del[1] %e \n del[2] %e\n del[3] %e\n", del[1], del[2],
                 del[3]);
 
-    c_i = (int)((c % nx[0]));
-    c_j = (int)(fmod((((double)c) / ((double)nx[0])), (double)nx[1]));
+    c_i = c % nx[0];
+    c_j = (c / nx[0]) % nx[1];
     if (ndimini == 3) {
-        c_k = (int)(((double)c) / ((double)nx[0] * nx[1]));
+        c_k = c / (nx[0] * nx[1]);
     }
 
     c_ip = c_i + 1;
@@ -963,43 +1767,29 @@ double interp_scalar(double **var, int c, double coeff[4]) {
         c_kp = c_k;
     }
 
-    b1 = 1. - del[1];
-    b2 = 1. - del[2];
-    b3 = 1. - del[3];
-
-    cindex[0][0][0] = compute_c(c_i, c_j, c_k);
-    cindex[1][0][0] = compute_c(c_ip, c_j, c_k);
-    cindex[0][1][0] = compute_c(c_i, c_jp, c_k);
-    cindex[0][0][1] = compute_c(c_i, c_j, c_kp);
-    cindex[1][1][0] = compute_c(c_ip, c_jp, c_k);
-    cindex[1][0][1] = compute_c(c_ip, c_j, c_kp);
-    cindex[0][1][1] = compute_c(c_i, c_jp, c_kp);
-    cindex[1][1][1] = compute_c(c_ip, c_jp, c_kp);
-
-    interp = var[cindex[0][0][0]][0] * b1 * b2 +
-             var[cindex[0][1][0]][0] * b1 * del[2] +
-             var[cindex[1][0][0]][0] * del[1] * b2 +
-             var[cindex[1][1][0]][0] * del[1] * del[2];
+#if (OUT_OF_CORE)
+    double *block = block_prims(igrid);
+#else
+    double *block = &PRIM(igrid, 0, 0);
+#endif
 
-    /* Now interpolate above in x3 */
-    interp = b3 * interp + del[3] * (var[cindex[0][0][1]][0] * b1 * b2 +
-                                     var[cindex[0][1][1]][0] * b1 * del[2] +
-                                     var[cindex[1][0][1]][0] * del[1] * b2 +
-                                     var[cindex[1][1][1]][0] * del[1] * del[2]);
+    corner[0] = block + compute_c(c_i, c_j, c_k) * NPRIM;
+    corner[1] = block + compute_c(c_i, c_jp, c_k) * NPRIM;
+    corner[2] = block + compute_c(c_ip, c_j, c_k) * NPRIM;
+    corner[3] = block + compute_c(c_ip, c_jp, c_k) * NPRIM;
+    corner[4] = block + compute_c(c_i, c_j, c_kp) * NPRIM;
+    corner[5] = block + compute_c(c_i, c_jp, c_kp) * NPRIM;
+    corner[6] = block + compute_c(c_ip, c_j, c_kp) * NPRIM;
+    corner[7] = block + compute_c(c_ip, c_jp, c_kp) * NPRIM;
 
-    return interp;
+    interp_fields(corner, NPRIM, del, prim);
 }
 
 // Get the fluid parameters in the local co-moving plasma frame.
 int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
-    double g_dd[NDIM][NDIM];
-    double g_uu[NDIM][NDIM];
     int igrid = (*modvar).igrid_c;
-    int i, c;
+    int c;
     double del[NDIM];
-    double rho, uu;
-    double Bp[NDIM], V_u[NDIM];
-    double gV_u[NDIM], gVdotgV;
 
 #if (metric == MKSBHAC || metric == MKSN)
     X[3] = fmod(X[3], 2 * M_PI);
@@ -1017,7 +1807,11 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
     if (r < 1.00)
         return 0;
 
-    double smalll = 1.e-6;
+    if (r > RT_OUTER_CUTOFF) {
+        (*modvar).n_e = 0;
+        return 0;
+    }
+
     double small = 0;
 
     if (X[1] > stopx[1] || X[1] < startx[1] || X[2] < startx[2] ||
@@ -1037,7 +1831,7 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
         X[3] + small >
             block_info[igrid].lb[2] +
                 (block_info[igrid].size[2]) * block_info[igrid].dxc_block[2]) {
-        (*modvar).igrid_c = find_igrid(X, block_info, Xgrid);
+        (*modvar).igrid_c = find_igrid(X, block_info);
         igrid = (*modvar).igrid_c;
     }
 
@@ -1051,26 +1845,59 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
 
     (*modvar).dx_local = block_info[igrid].dxc_block[0];
 
-    c = find_cell(X, block_info, igrid, Xgrid);
+#if (EMISSION_MASK)
+    if (!block_emits[igrid]) {
+        (*modvar).n_e = 0;
+        return 0;
+    }
+#endif
 
-    metric_uu(X, g_uu);
+    c = find_cell(X, block_info, igrid);
 
-    metric_dd(X, g_dd);
+#if (EMISSION_MASK)
+    if (!CAN_EMIT(igrid, c)) {
+        (*modvar).n_e = 0;
+        return 0;
+    }
+#endif
 
     coefficients(X, block_info, igrid, c, del);
 
-    rho = interp_scalar(p[KRHO][igrid], c, del);
-    uu = interp_scalar(p[UU][igrid], c, del);
+    double prim[NPRIM];
+    interp_prims(igrid, c, del, prim);
+
+    return fluid_params_from_prims(X, prim, modvar);
+}
+
+// Fills the fluid quantities at X from the primitives there, returns 0 if
+// they are cut from the emission
+int fluid_params_from_prims(double X[NDIM], double prim[NPRIM],
+                            struct GRMHD *modvar) {
+    double g_dd[NDIM][NDIM];
+    double g_uu[NDIM][NDIM];
+    int i;
+    double rho, uu;
+    double Bp[NDIM], V_u[NDIM];
+    double gV_u[NDIM], gVdotgV;
+
+    double smalll = 1.e-6;
+
+    metric_uu(X, g_uu);
+
+    metric_dd(X, g_dd);
+
+    rho = prim[KRHO];
+    uu = prim[UU];
 
     (*modvar).n_e = rho * Ne_unit + smalll;
 
-    Bp[1] = interp_scalar(p[B1][igrid], c, del);
-    Bp[2] = interp_scalar(p[B2][igrid], c, del);
-    Bp[3] = interp_scalar(p[B3][igrid], c, del);
+    Bp[1] = prim[B1];
+    Bp[2] = prim[B2];
+    Bp[3] = prim[B3];
 
-    gV_u[1] = interp_scalar(p[U1][igrid], c, del);
-    gV_u[2] = interp_scalar(p[U2][igrid], c, del);
-    gV_u[3] = interp_scalar(p[U3][igrid], c, del);
+    gV_u[1] = prim[U1];
+    gV_u[2] = prim[U2];
+    gV_u[3] = prim[U3];
 
     double gamma_dd[4][4];
     for (int i = 1; i < 4; i++) {
@@ -1135,18 +1962,8 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
 
 #if (DEBUG)
     if (isnan(Bsq) || isnan((*modvar).B)) {
-        double R2 = Xgrid[igrid][c][1] * Xgrid[igrid][c][1] +
-                    Xgrid[igrid][c][2] * Xgrid[igrid][c][2] +
-                    Xgrid[igrid][c][3] * Xgrid[igrid][c][3];
-        double a2 = a * a;
-        double r2 = (R2 - a2 +
-                     sqrt((R2 - a2) * (R2 - a2) +
-                          4. * a2 * Xgrid[igrid][c][3] * Xgrid[igrid][c][3])) *
-                    0.5;
-        fprintf(stderr, "B isnan r %e rmin %e\n", sqrt(r2), CUTOFF_INNER);
+        fprintf(stderr, "B isnan r %e rmin %e\n", get_r(X), CUTOFF_INNER);
         fprintf(stderr, "B isnan X %e %e %e %e\n", X[0], X[1], X[2], X[3]);
-        fprintf(stderr, "B isnan Xgrid %e %e %e\n", Xgrid[igrid][c][0],
-                Xgrid[igrid][c][1], Xgrid[igrid][c][2]);
         fprintf(stderr, "B isnan Bsq %e B_u %e %e %e %e U_u %e %e %e %e\n", Bsq,
                 (*modvar).B_u[0], (*modvar).B_u[1], (*modvar).B_u[2],
                 (*modvar).B_u[3], (*modvar).U_u[0], (*modvar).U_u[1],
@@ -1179,12 +1996,8 @@ int get_fluid_params(double X[NDIM], struct GRMHD *modvar) {
     Thetae_unit = 1. / 3. * (MPoME) / (trat + 1);
 
     (*modvar).theta_e = (uu / rho) * Thetae_unit;
-    double xc = r * sin(X[2]) * cos(X[3]);
-    double yc = r * sin(X[2]) * sin(X[3]);
-    double rc = sqrt(xc * xc + yc * yc);
 
-    if ((Bsq / (rho + 1e-20) > SIGMA_CUT) || r > RT_OUTER_CUTOFF ||
-        (*modvar).theta_e > THETAE_MAX ||
+    if ((Bsq / (rho + 1e-20) > SIGMA_CUT) || (*modvar).theta_e > THETAE_MAX ||
         (*modvar).theta_e < THETAE_MIN) { // excludes all spine emmission
         (*modvar).n_e = 0;
         return 0;
@@ -10,6 +10,39 @@
 
 #define SFC 0
 
+// Store the converted primitives and block tree of a dump next to it as
+// <dump>SNAPSHOT_SUFFIX, later runs on the same dump load that instead
+#define SNAPSHOT (0)
+#define SNAPSHOT_SUFFIX ".raptor"
+// Store the primitives in single precision, halves the file but they are
+// then copied into memory instead of used from the mapped file
+#define SNAPSHOT_FLOAT (0)
+
+// Keep only a bounded LRU cache of blocks in memory and read the others from
+// the snapshot when a ray enters them. The dump is streamed into a snapshot
+// first if there is none.
+#define OUT_OF_CORE (0)
+#define BLOCK_CACHE_MB (4096)
+
+// Drop blocks beyond RT_OUTER_CUTOFF at load time and keep a per-block and
+// per-cell mask of where sigma stays below SIGMA_CUT, samples that can not
+// emit are rejected before any metric or interpolation work
+#define EMISSION_MASK (0)
+// sigma of the interpolated fields is not bounded by that of the stencil
+// cells, so cells are masked only above this multiple of SIGMA_CUT
+#define MASK_SIGMA_MARGIN (2.)
+// Cap geodesic steps at the cell size only in blocks that can emit, rays cross
+// the other blocks with steps set by the integrator alone. Needs
+// EMISSION_MASK; the lightpaths then depend on the snapshot, which the key of
+// GEO_CACHE does not hold.
+#define SKIP_EMPTY_BLOCKS (0)
+#if (SKIP_EMPTY_BLOCKS && !EMISSION_MASK)
+#error "SKIP_EMPTY_BLOCKS needs EMISSION_MASK"
+#endif
+#if (SKIP_EMPTY_BLOCKS && GEO_CACHE)
+#error "SKIP_EMPTY_BLOCKS can not be combined with GEO_CACHE"
+#endif
+
 #define KRHO 0
 #define UU 1
 #define U1 2
@@ -19,6 +52,17 @@
 #define B2 6
 #define B3 7
 
+// Primitive q of cell c in block igrid, p is stored as [block][cell][prim]
+#define PRIM(igrid, c, q) p[((size_t)(igrid) * cells + (c)) * NPRIM + (q)]
+
+// Set if the interpolation stencil of cell c in block igrid holds a cell that
+// can emit, every block starts its mask on a new byte
+#define CAN_EMIT(igrid, c)                                                     \
+    (emit_mask[(size_t)(igrid) * mask_bytes + ((c) >> 3)] & (1 << ((c) & 7)))
+
+// Tree leaf of a block that was dropped at load time
+#define CROPPED_BLOCK (-2)
+
 #define D 0
 #define S1 1
 #define S2 2
@@ -51,9 +95,22 @@ typedef struct GRMHD {
     int igrid_c;
 } GRMHD;
 
+typedef struct block_cache_slot {
+    int igrid, pins, loading;
+    long last_use;
+    double *prims;
+} block_cache_slot;
+
 typedef struct block {
     int ind[3], level, size[3];
     double lb[3], dxc_block[3];
 } block;
 
+// node of the AMR forest, igrid >= 0 for leaves, child slots follow the
+// ordering of new_index
+typedef struct tree_node {
+    int igrid;
+    int child[8];
+} tree_node;
+
 #endif
@@ -18,12 +18,45 @@ double interp_scalar_2D(double ***var, int i, int j, int k, double coeff[4]);
 
 void Xtoij(double *X, int *i, int *j, double *del);
 
-double interp_scalar(double **var, int c, double coeff[4]);
+int compute_c(int i, int j, int k);
+
+void interp_prims(int igrid, int c, double del[4], double prim[NPRIM]);
 
 void lower(double *ucon, double Gcov[NDIM][NDIM], double *ucov);
 
 double get_detgamma(double x, double y, double z);
 
-int find_igrid(double x[4], struct block *block_info, double ***Xc);
+int find_igrid(double x[4], struct block *block_info);
+
+int fluid_params_from_prims(double X[NDIM], double prim[NPRIM],
+                            struct GRMHD *modvar);
+
+double block_r_min(int igrid);
+
+void crop_blocks(int *block_dest);
+
+int stencil_can_emit(unsigned char *emits, double *prims, size_t corner[8]);
+
+void build_emission_mask(int igrid, double *prims);
+
+double block_exit_step(double X_u[4], double U_u[4], int igrid);
+
+uint64_t block_layout_hash();
+
+int snapshot_load(char *fname);
+
+void snapshot_save(char *fname);
+
+FILE *snapshot_create(char *fname);
+
+size_t snapshot_write_prims(FILE *file, double *prims, size_t size);
+
+void block_cache_init(char *filename);
+
+void block_cache_read(int igrid, double *prims);
+
+double *block_prims(int igrid);
+
+void block_cache_report();
 
 #endif
@@ -8,7 +8,8 @@
 #ifndef MODEL_GLOBAL_VARS_H
 #define MODEL_GLOBAL_VARS_H
 
-extern double ****p;
+extern double *p;
+extern int cells;
 
 extern double L_unit, T_unit;
 extern double RHO_unit, U_unit, B_unit;
@@ -17,6 +18,14 @@ extern double Ne_unit, Thetae_unit;
 extern double R0, a, Q, hslope;
 extern double stopx[4], startx[4], dx[4];
 
-extern double ***Xgrid;
 extern struct block *block_info;
+
+extern unsigned char *emit_mask, *block_emits;
+extern int mask_bytes;
+
+#if (SKIP_EMPTY_BLOCKS)
+extern long empty_steps;
+extern double empty_steps_capped;
+#pragma omp threadprivate(empty_steps, empty_steps_capped)
+#endif
 #endif // MODEL_GLOBAL_VARS_H
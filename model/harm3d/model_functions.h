@@ -13,6 +13,15 @@
 #ifndef MODEL_FUNCTIONS_H
 #define MODEL_FUNCTIONS_H
 
-double interp_scalar(double ***var, int i, int j, int k, double coeff[4]);
+void interp_prims(int i, int j, int k, double del[4], double prim[NPRIM]);
+
+int fluid_params_from_prims(double X[NDIM], double prim[NPRIM],
+                            struct GRMHD *modvar);
+
+void crop_radius(void);
+
+int stencil_can_emit(unsigned char *emits, double *prims, size_t corner[8]);
+
+void build_emission_mask(void);
 
 #endif // RAPTOR_HARM_MODEL_H
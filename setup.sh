@@ -121,6 +121,16 @@ then
       	sed -i  '/#define int_method (/s/.*/#define int_method (RK45)/' definitions.h
 fi
 
+if [ "$INT" == "mino" ] ;
+then
+      	sed -i  '/#define int_method (/s/.*/#define int_method (MINO)/' definitions.h
+fi
+
+if [ "$INT" == "dopri5" ] ;
+then
+      	sed -i  '/#define int_method (/s/.*/#define int_method (DOPRI5)/' definitions.h
+fi
+
 if [ "$GRID" == "SMR" ] ;
 then
 
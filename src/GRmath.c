@@ -370,6 +370,94 @@ void KS_to_CKS_u(double *KScoords, double *CKScoords) {
     }
 }
 
+// Transform a PHOTON from BL to the coordinates in use; BLphoton_u and
+// photon_u may be the same array
+void BL_to_code_u(double *BLphoton_u, double *photon_u) {
+    LOOP_i {
+        photon_u[i] = BLphoton_u[i];
+        photon_u[i + 4] = BLphoton_u[i + 4];
+    }
+
+#if (metric == KS || metric == MKS || metric == MKSHARM || metric == MKSN ||   \
+     metric == CKS || metric == MKSBHAC)
+
+    double KSphoton_u[8];
+    BL_to_KS_u(photon_u, KSphoton_u);
+    LOOP_i {
+        photon_u[i] = KSphoton_u[i];
+        photon_u[i + 4] = KSphoton_u[i + 4];
+    }
+
+#endif
+
+#if (metric == MKSHARM || metric == MKSBHAC)
+
+    photon_u[2] =
+        Xg2_approx_rand(photon_u[2]); // We only transform theta - r is
+                                      // already exponential and R0 = 0
+
+    photon_u[6] =
+        Ug2_approx_rand(photon_u[6],
+                        photon_u[2]); // We only transform theta - r is
+                                      // already exponential and R0 = 0
+#endif
+
+#if (metric == CKS)
+    double photon_u_KS[8];
+
+    LOOP_i {
+        photon_u_KS[i] = photon_u[i];
+        photon_u_KS[i + 4] = photon_u[i + 4];
+    }
+
+    KS_to_CKS_u(photon_u_KS, photon_u);
+
+#endif
+}
+
+// Transform a PHOTON from the coordinates in use back to BL, undoing the
+// conversions of initialize_photon
+void code_to_BL_u(double *photon_u, double *BLphoton_u) {
+    double KSphoton_u[8];
+
+    LOOP_i {
+        KSphoton_u[i] = photon_u[i];
+        KSphoton_u[i + 4] = photon_u[i + 4];
+    }
+
+#if (metric == CKS)
+    // Invert the Jacobian of KS_to_CKS_u, using x + iy = (r - ia) sin(theta)
+    // exp(i phi)
+    CKS_to_KS(photon_u, KSphoton_u);
+    double x = photon_u[1], y = photon_u[2], z = photon_u[3];
+    double r = KSphoton_u[1];
+    double R2 = x * x + y * y + z * z;
+    double Vx = photon_u[5], Vy = photon_u[6], Vz = photon_u[7];
+
+    double Vr = (r * r * (x * Vx + y * Vy + z * Vz) + a * a * z * Vz) /
+                (2. * r * r * r - (R2 - a * a) * r);
+    KSphoton_u[5] = Vr;
+    KSphoton_u[6] = (z * Vr / r - Vz) / (r * sin(KSphoton_u[2]));
+    KSphoton_u[7] =
+        (x * Vy - y * Vx) / (x * x + y * y) - a * Vr / (r * r + a * a);
+#endif
+
+#if (metric == MKSHARM || metric == MKSBHAC)
+    KSphoton_u[6] = photon_u[6] * f_primed_Xg2(photon_u[2]);
+    KSphoton_u[2] = f_Xg2(photon_u[2], 0.);
+#endif
+
+#if (metric == KS || metric == MKS || metric == MKSHARM || metric == MKSN ||   \
+     metric == CKS || metric == MKSBHAC)
+    KS_to_BL_u(KSphoton_u, BLphoton_u);
+#else
+    LOOP_i {
+        BLphoton_u[i] = KSphoton_u[i];
+        BLphoton_u[i + 4] = KSphoton_u[i + 4];
+    }
+#endif
+}
+
 // Compute the photon frequency in the plasma frame:
 double freq_in_plasma_frame(double Uplasma_u[4], double k_d[4]) {
     double nu_plasmaframe = 0.;
@@ -406,3 +494,31 @@ double pitch_angle(double *X_u, double *k_u, double *B_u, double *Uplasma_u) {
 
     return (acos(mu));
 }
+
+// Trilinear interpolation of n fields in a single pass. corner[] points at
+// the first field of the eight stencil corners, ordered (i, j, k),
+// (i, j+1, k), (i+1, j, k), (i+1, j+1, k) followed by the same four at k+1,
+// and the n fields of a corner are consecutive in memory. del[1..3] are the
+// fractional offsets in the three directions.
+void interp_fields(double *corner[8], int n, double del[4], double *out) {
+    double b1 = 1. - del[1];
+    double b2 = 1. - del[2];
+    double b3 = 1. - del[3];
+
+    double w[8];
+    w[0] = b1 * b2 * b3;
+    w[1] = b1 * del[2] * b3;
+    w[2] = del[1] * b2 * b3;
+    w[3] = del[1] * del[2] * b3;
+    w[4] = b1 * b2 * del[3];
+    w[5] = b1 * del[2] * del[3];
+    w[6] = del[1] * b2 * del[3];
+    w[7] = del[1] * del[2] * del[3];
+
+    for (int q = 0; q < n; q++) {
+        out[q] = w[0] * corner[0][q] + w[1] * corner[1][q] +
+                 w[2] * corner[2][q] + w[3] * corner[3][q] +
+                 w[4] * corner[4][q] + w[5] * corner[5][q] +
+                 w[6] * corner[6][q] + w[7] * corner[7][q];
+    }
+}
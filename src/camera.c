@@ -129,7 +129,7 @@ void add_block(struct Camera **intensityfield, int current_block) {
 }
 
 // Checks if a refinement criterion is met, returns 1 if that is the case
-int refine_block(struct Camera intensity) {
+int refine_block(struct Camera *intensity) {
     int pixel1, pixel2, pixel3;
     double gradI_x, gradI_y;
     double gradImax = -1e100;
@@ -141,12 +141,12 @@ int refine_block(struct Camera intensity) {
                 pixel2 = ypixel + 1 + xpixel * num_pixels_1d;
                 pixel3 = ypixel + (xpixel + 1) * num_pixels_1d;
 
-                gradI_y = fabs(intensity.IQUV[pixel2][freq][0] -
-                               intensity.IQUV[pixel1][freq][0]) /
-                          (intensity.IQUV[pixel1][freq][0] + 1e-40);
-                gradI_x = fabs(intensity.IQUV[pixel3][freq][0] -
-                               intensity.IQUV[pixel1][freq][0]) /
-                          (intensity.IQUV[pixel1][freq][0] + 1e-40);
+                gradI_y = fabs((*intensity).IQUV[pixel2][freq][0] -
+                               (*intensity).IQUV[pixel1][freq][0]) /
+                          ((*intensity).IQUV[pixel1][freq][0] + 1e-40);
+                gradI_x = fabs((*intensity).IQUV[pixel3][freq][0] -
+                               (*intensity).IQUV[pixel1][freq][0]) /
+                          ((*intensity).IQUV[pixel1][freq][0] + 1e-40);
 
                 if (gradI_x > gradImax)
                     gradImax = gradI_x;
@@ -156,7 +156,7 @@ int refine_block(struct Camera intensity) {
         }
     }
 
-    if (gradImax > 0.25 && intensity.level < max_level)
+    if (gradImax > 0.25 && (*intensity).level < max_level)
         return 1;
     else
         return 0;
@@ -216,6 +216,107 @@ void prerun_refine(struct Camera **intensityfield) {
     }
 }
 
+// Appends the leaves below a quadtree node to leaves in depth-first order,
+// returns the new number of leaves
+int collect_leaves(struct Camera *tree, int *child, int node,
+                   struct Camera *leaves, int n_leaves) {
+    if (child[node] < 0) {
+        leaves[n_leaves] = tree[node];
+        return n_leaves + 1;
+    }
+    for (int i = 0; i < 4; i++)
+        n_leaves =
+            collect_leaves(tree, child, child[node] + i, leaves, n_leaves);
+    return n_leaves;
+}
+
+// Traces and adaptively refines the camera one level at a time. All blocks
+// of a level are traced as one pool and tested for refinement in parallel,
+// then the children of every refined block are created in a single batch.
+// The blocks form a quadtree that is flattened depth-first at the end, which
+// gives the same block order as refining block by block.
+void refine_camera(struct Camera **intensityfield,
+                   double frequencies[num_frequencies]) {
+    int n_nodes = tot_blocks;
+    int *child = malloc(n_nodes * sizeof(int));
+    for (int node = 0; node < n_nodes; node++)
+        child[node] = -1;
+
+    int first = 0;
+    int n_level = n_nodes;
+    int n_leaves = n_nodes;
+    int pass = 0;
+
+    while (n_level > 0) {
+        fprintf(stderr, "refinement pass %d: tracing %d blocks\n", pass,
+                n_level);
+        calculate_image_blocks(&(*intensityfield)[first], n_level,
+                               frequencies);
+
+        int *refine = malloc(n_level * sizeof(int));
+#pragma omp parallel for schedule(static)
+        for (int block = 0; block < n_level; block++)
+            refine[block] = refine_block(&(*intensityfield)[first + block]);
+
+        int n_new = 0;
+        for (int block = 0; block < n_level; block++) {
+            if (refine[block]) {
+                child[first + block] = n_nodes + n_new;
+                n_new += 4;
+            }
+        }
+
+        if (n_new > 0) {
+            (*intensityfield) = realloc(
+                (*intensityfield), (n_nodes + n_new) * sizeof(struct Camera));
+            child = realloc(child, (n_nodes + n_new) * sizeof(int));
+            if ((*intensityfield) == NULL || child == NULL) {
+                fprintf(stderr, "Cannot allocate %d camera blocks\n",
+                        n_nodes + n_new);
+                exit(1);
+            }
+
+            int cind_i, cind_j;
+            for (int block = first; block < first + n_level; block++) {
+                if (child[block] < 0)
+                    continue;
+                int ind_i = (*intensityfield)[block].ind[0];
+                int ind_j = (*intensityfield)[block].ind[1];
+                int new_level = (*intensityfield)[block].level + 1;
+                for (int i = 0; i < 4; i++) {
+                    int node = child[block] + i;
+                    new_cindex(i, &cind_i, &cind_j, ind_i, ind_j);
+                    (*intensityfield)[node].ind[0] = cind_i;
+                    (*intensityfield)[node].ind[1] = cind_j;
+                    (*intensityfield)[node].level = new_level;
+                    child[node] = -1;
+
+                    get_impact_params(intensityfield, node);
+                }
+            }
+        }
+        free(refine);
+
+        // Every refined block swaps one leaf for four
+        n_leaves += 3 * (n_new / 4);
+        first = n_nodes;
+        n_level = n_new;
+        n_nodes += n_new;
+        pass++;
+    }
+
+    struct Camera *leaves = malloc(n_leaves * sizeof(struct Camera));
+    int n_collected = 0;
+    for (int root = 0; root < tot_blocks; root++)
+        n_collected =
+            collect_leaves(*intensityfield, child, root, leaves, n_collected);
+
+    free(*intensityfield);
+    free(child);
+    (*intensityfield) = leaves;
+    tot_blocks = n_collected;
+}
+
 // Initialzies a single pixel, assigns wave vector to it.
 void init_pixel(double alpha, double beta, double t, double photon_u[8]) {
 #if (LINEAR_IMPACT_CAM)
@@ -26,12 +26,36 @@ int IMG_WIDTH, IMG_HEIGHT;
 double CAM_SIZE_X, CAM_SIZE_Y;
 double STEPSIZE;
 
+// Relative and absolute tolerance of the Dormand-Prince integrator
+double RTOL = 1.e-9, ATOL = 1.e-12;
+
+// Lightpath buffers of each thread, one per lane of a ray packet, reused for
+// all of its pixels and grown by integrate_geodesic when a ray needs more
+// steps; packet_steps holds the steps of the lanes of the current packet
+double *lightpath_buffer[RAY_PACKET] = {NULL};
+int lightpath_capacity[RAY_PACKET] = {0};
+int packet_steps[RAY_PACKET];
+#pragma omp threadprivate(lightpath_buffer, lightpath_capacity,               \
+                          packet_steps)
+
+// Geodesic steps integrated for the image, and of those the steps through
+// blocks that can not emit with the grid capped steps they stand in for
+long image_steps = 0;
+long image_empty_steps = 0;
+double image_empty_capped = 0.;
+
+// Rays integrated by the Dormand-Prince integrator, its rejected steps and
+// derivative evaluations, and the summed and largest relative drift of k_t
+long image_rays = 0, image_rejected = 0, image_evals = 0;
+double image_drift = 0., image_drift_max = 0.;
+
 // FUNCTIONS
 ////////////
 
 // Read model parameters from model.in
 void read_model(char *argv[]) {
     char temp[100], temp2[100];
+    double value;
     FILE *input;
     char inputfile[100];
 
@@ -63,6 +87,14 @@ void read_model(char *argv[]) {
     fscanf(input, "%s %s %lf", temp, temp2, &STEPSIZE);
     fscanf(input, "%s %s %d", temp, temp2, &max_level);
 
+    // Optional parameters, in any order
+    while (fscanf(input, "%s %s %lf", temp, temp2, &value) == 3) {
+        if (strcmp(temp, "RTOL") == 0)
+            RTOL = value;
+        else if (strcmp(temp, "ATOL") == 0)
+            ATOL = value;
+    }
+
     // Second argument: GRMHD file
     sscanf(argv[2], "%s", GRMHD_FILE);
     sscanf(argv[3], "%lf", &TIME_INIT);
@@ -92,6 +124,10 @@ void read_model(char *argv[]) {
     fprintf(stderr, "FREQS_PER_DEC \t= %lf \n", FREQS_PER_DEC);
     fprintf(stderr, "FREQ_MIN \t= %g Hz\n", FREQ_MIN);
     fprintf(stderr, "STEPSIZE \t= %g \n", STEPSIZE);
+#if (int_method == DOPRI5)
+    fprintf(stderr, "RTOL \t\t= %g \n", RTOL);
+    fprintf(stderr, "ATOL \t\t= %g \n", ATOL);
+#endif
 
     // to cgs units
     MBH *= MSUN;
@@ -104,58 +140,272 @@ void read_model(char *argv[]) {
 // geodesic integrations as well as radiation transfer
 void calculate_image_block(struct Camera *intensityfield,
                            double frequencies[num_frequencies]) {
+    calculate_image_blocks(intensityfield, 1, frequencies);
+}
 
-#pragma omp parallel for shared(frequencies, intensityfield, p)                \
-    schedule(static, 1)
-    for (int pixel = 0; pixel < tot_pixels; pixel++) {
-        int steps = 0;
+// Traces the n_blocks consecutive blocks starting at intensityfield as one
+// pool of (block, pixel) work items. Threads take pixels one at a time, so
+// expensive pixels near the photon ring do not leave the other threads
+// waiting at a barrier after every block. With RAY_PACKET > 1 threads take
+// packets of that many consecutive pixels, whose geodesics are integrated
+// together by the first pixel of the packet.
+void calculate_image_blocks(struct Camera *intensityfield, int n_blocks,
+                            double frequencies[num_frequencies]) {
+    long tot_items = (long)n_blocks * tot_pixels;
+    int *pixels_done = calloc(n_blocks, sizeof(int));
+    int blocks_done = 0;
+    long traced_steps = 0, traced_empty = 0;
+    double traced_capped = 0.;
+    long traced_rays = 0, traced_rejected = 0, traced_evals = 0;
+    double traced_drift = 0., traced_drift_max = 0.;
+
+#if (GEO_CACHE)
+    int *entry = malloc(n_blocks * sizeof(int));
+    double **lightpaths = malloc(tot_items * sizeof(double *));
+    int *steps_pixel = malloc(tot_items * sizeof(int));
+    for (int block = 0; block < n_blocks; block++)
+        entry[block] = geo_cache_find(&intensityfield[block]);
+#endif
 
-        double *lightpath2 = malloc(9 * max_steps * sizeof(double));
+#pragma omp parallel for shared(frequencies, intensityfield, pixels_done,     \
+                                    blocks_done) schedule(dynamic, RAY_PACKET) \
+    reduction(+ : traced_steps, traced_empty, traced_capped, traced_rays,     \
+                  traced_rejected, traced_evals, traced_drift)                 \
+    reduction(max : traced_drift_max)
+    for (long item = 0; item < tot_items; item++) {
+        int block = item / tot_pixels;
+        int pixel = item % tot_pixels;
+        int lane = item % RAY_PACKET;
+        struct Camera *camera = &intensityfield[block];
+        int steps = 0;
+        double *lightpath2;
+
+#if (RAY_PACKET > 1)
+        // The chunk of this thread is the whole packet, so the lightpaths of
+        // its later pixels are ready when the thread gets to them. Lanes past
+        // the last pixel repeat it, and cached pixels are not traced.
+        if (lane == 0) {
+            double alpha[RAY_PACKET], beta[RAY_PACKET];
+            int active[RAY_PACKET];
+            for (int l = 0; l < RAY_PACKET; l++) {
+                long lane_item = (item + l < tot_items) ? item + l : item;
+                struct Camera *lane_camera =
+                    &intensityfield[lane_item / tot_pixels];
+                alpha[l] = (*lane_camera).alpha[lane_item % tot_pixels];
+                beta[l] = (*lane_camera).beta[lane_item % tot_pixels];
+                active[l] = (item + l < tot_items);
+#if (GEO_CACHE)
+                active[l] = active[l] && entry[lane_item / tot_pixels] < 0;
+#endif
+            }
+#if (metric == MKSBHAC && SKIP_EMPTY_BLOCKS)
+            long empty_before = empty_steps;
+            double capped_before = empty_steps_capped;
+#endif
+            integrate_geodesic_packet(alpha, beta, active, lightpath_buffer,
+                                      lightpath_capacity, packet_steps,
+                                      CUTOFF_INNER);
+            for (int l = 0; l < RAY_PACKET; l++)
+                if (active[l])
+                    traced_steps += packet_steps[l];
+#if (metric == MKSBHAC && SKIP_EMPTY_BLOCKS)
+            traced_empty += empty_steps - empty_before;
+            traced_capped += empty_steps_capped - capped_before;
+#endif
+        }
+#endif
 
 #if (POL)
         double f_x = 0.;
         double f_y = 0.;
         double p = 0.;
+#elif (OBSERVER_SIDE)
+        int transferred = 0;
+#endif
+#if (GEO_CACHE)
+        if (entry[block] >= 0) {
+            lightpath2 = geo_cache_lightpath(entry[block], pixel, &steps);
+        } else
+#endif
+        {
+#if (RAY_PACKET > 1)
+            steps = packet_steps[lane];
+#else
+#if (metric == MKSBHAC && SKIP_EMPTY_BLOCKS)
+            long empty_before = empty_steps;
+            double capped_before = empty_steps_capped;
+#endif
+#if (int_method == DOPRI5)
+            long rays_before = dopri_rays, rejected_before = dopri_rejected;
+            long evals_before = dopri_evals;
+            double drift_before = dopri_drift_sum;
+#endif
+#if (OBSERVER_SIDE == 2 && !POL && !GEO_CACHE)
+            // INTEGRATE THIS PIXEL'S GEODESIC STEP BY STEP INTO ITS TRANSFER.
+            // Only the camera entry is stored, steps counts all of them, and
+            // the ray stops once the plasma in front of it is opaque.
+            struct Ray ray;
+            struct Transfer rt;
+            double entry[9], dl_prev = 0.;
+            geodesic_start((*camera).alpha[pixel], (*camera).beta[pixel], &ray,
+                           &lightpath_buffer[lane], &lightpath_capacity[lane],
+                           &steps);
+            transfer_start(&rt, frequencies, (*camera).IQUV[pixel],
+                           (*camera).I_radial_cut[pixel], (*camera).tau[pixel]);
+            while (geodesic_step(&ray, entry, CUTOFF_INNER)) {
+                // The camera entry has no step in front of it
+                if (ray.steps > 1 &&
+                    transfer_step(&rt, &entry[0], &entry[4], dl_prev))
+                    break;
+                dl_prev = entry[8];
+            }
+            steps = ray.steps;
+            transferred = 1;
+#elif (OBSERVER_SIDE && !POL)
+            // INTEGRATE THIS PIXEL'S GEODESIC ALONGSIDE ITS TRANSFER, in
+            // segments of 64 steps, and stop once the plasma in front of the
+            // ray is opaque. Stored geodesics are integrated in full.
+            struct Ray ray;
+            int opaque = 0;
+            geodesic_start((*camera).alpha[pixel], (*camera).beta[pixel], &ray,
+                           &lightpath_buffer[lane], &lightpath_capacity[lane],
+                           &steps);
+            while (!ray.done && (!opaque || GEO_CACHE)) {
+                int first = steps;
+                geodesic_advance(&ray, &lightpath_buffer[lane],
+                                 &lightpath_capacity[lane], &steps, steps + 64,
+                                 CUTOFF_INNER);
+                if (!opaque)
+                    opaque = radiative_transfer_observer(
+                        lightpath_buffer[lane], first, steps, frequencies,
+                        (*camera).IQUV[pixel], (*camera).I_radial_cut[pixel],
+                        (*camera).tau[pixel]);
+            }
+            transferred = 1;
+#else
+            // INTEGRATE THIS PIXEL'S GEODESIC
+            integrate_geodesic((*camera).alpha[pixel], (*camera).beta[pixel],
+                               &lightpath_buffer[lane],
+                               &lightpath_capacity[lane], &steps,
+                               CUTOFF_INNER);
+#endif
+            traced_steps += steps;
+#if (metric == MKSBHAC && SKIP_EMPTY_BLOCKS)
+            traced_empty += empty_steps - empty_before;
+            traced_capped += empty_steps_capped - capped_before;
 #endif
-        // INTEGRATE THIS PIXEL'S GEODESIC
-        integrate_geodesic((*intensityfield).alpha[pixel],
-                           (*intensityfield).beta[pixel], lightpath2, &steps,
-                           CUTOFF_INNER);
+#if (int_method == DOPRI5)
+            traced_rays += dopri_rays - rays_before;
+            traced_rejected += dopri_rejected - rejected_before;
+            traced_evals += dopri_evals - evals_before;
+            traced_drift += dopri_drift_sum - drift_before;
+            traced_drift_max = fmax(traced_drift_max, dopri_drift_max);
+#endif
+#endif
+            lightpath2 = lightpath_buffer[lane];
+        }
         // PERFORM RADIATIVE TRANSFER AT DESIRED FREQUENCIES, STORE RESULTS
 #if (POL)
-        for (int f = 0; f < num_frequencies; f++) {
-
-            radiative_transfer_polarized(lightpath2, steps, frequencies[f],
-                                         &f_x, &f_y, &p, 0,
-                                         (*intensityfield).IQUV[pixel][f],
-                                         &(*intensityfield).tau[pixel][f],
-                                         &(*intensityfield).tauF[pixel][f]);
-        }
+        radiative_transfer_polarized(lightpath2, steps, frequencies, &f_x,
+                                     &f_y, &p, 0, (*camera).IQUV[pixel],
+                                     (*camera).tau[pixel],
+                                     (*camera).tauF[pixel]);
 
-#elif (RADIAL_CUT)
+#else
+#if (OBSERVER_SIDE)
+        if (!transferred)
+            radiative_transfer_observer(lightpath2, 1, steps, frequencies,
+                                        (*camera).IQUV[pixel],
+                                        (*camera).I_radial_cut[pixel],
+                                        (*camera).tau[pixel]);
+#else
         radiative_transfer_unpolarized(lightpath2, steps, frequencies,
-                                       (*intensityfield).IQUV[pixel],
-                                       (*intensityfield).I_radial_cut[pixel],
-                                       &(*intensityfield).tau[pixel]);
+                                       (*camera).IQUV[pixel],
+                                       (*camera).I_radial_cut[pixel],
+                                       (*camera).tau[pixel]);
+#endif
         for (int f = 0; f < num_frequencies; f++) {
-            (*intensityfield).I_radial_cut[pixel][f][0] *= pow(frequencies[f], 3.);
-            (*intensityfield).I_radial_cut[pixel][f][1] *= pow(frequencies[f], 3.);
-            (*intensityfield).I_radial_cut[pixel][f][2] *= pow(frequencies[f], 3.);
-            (*intensityfield).I_radial_cut[pixel][f][3] *= pow(frequencies[f], 3.);
-            (*intensityfield).I_radial_cut[pixel][f][4] *= pow(frequencies[f], 3.);
+            (*camera).IQUV[pixel][f][0] *= pow(frequencies[f], 3.);
+#if (RADIAL_CUT)
+            for (int s = 0; s < 5; s++)
+                (*camera).I_radial_cut[pixel][f][s] *= pow(frequencies[f], 3.);
+#endif
         }
-#else 
-         radiative_transfer_unpolarized(lightpath2, steps, frequencies,
-                                       (*intensityfield).IQUV[pixel],
-                                       (*intensityfield).I_radial_cut[pixel],
-                                       &(*intensityfield).tau[pixel]);
-        for (int f = 0; f < num_frequencies; f++) {
-            (*intensityfield).IQUV[pixel][f][0] *= pow(frequencies[f], 3.);
+#endif
+#if (GEO_CACHE)
+        if (entry[block] < 0) {
+            lightpaths[item] = malloc(9 * (size_t)steps * sizeof(double));
+            memcpy(lightpaths[item], lightpath2,
+                   9 * (size_t)steps * sizeof(double));
+            steps_pixel[item] = steps;
         }
 #endif
-        free(lightpath2);
+
+        // The thread finishing the last pixel of a block closes it off
+        int done;
+#pragma omp atomic capture
+        done = ++pixels_done[block];
+        if (done == tot_pixels) {
+#if (GEO_CACHE)
+            if (entry[block] < 0) {
+                long first = (long)block * tot_pixels;
+#pragma omp critical(geo_cache)
+                geo_cache_store(camera, &lightpaths[first],
+                                &steps_pixel[first]);
+                for (int i = 0; i < tot_pixels; i++)
+                    free(lightpaths[first + i]);
+            }
+#endif
+            int finished;
+#pragma omp atomic capture
+            finished = ++blocks_done;
+            if (n_blocks > 1 && finished % 25 == 0)
+                fprintf(stderr, "block %d of total %d\n", finished, n_blocks);
+        }
+    }
+
+#if (GEO_CACHE)
+    free(entry);
+    free(lightpaths);
+    free(steps_pixel);
+#endif
+    free(pixels_done);
+
+    image_steps += traced_steps;
+    image_empty_steps += traced_empty;
+    image_empty_capped += traced_capped;
+    image_rays += traced_rays;
+    image_rejected += traced_rejected;
+    image_evals += traced_evals;
+    image_drift += traced_drift;
+    image_drift_max = fmax(image_drift_max, traced_drift_max);
+}
+
+// Reports the geodesic steps integrated for the image, how many the grid cap
+// would have taken in blocks that can not emit, and the work and accuracy of
+// the Dormand-Prince integrator
+void report_image_steps() {
+    fprintf(stderr, "Integrated %ld geodesic steps\n", image_steps);
+    if (image_empty_steps > 0) {
+        double capped = image_steps - image_empty_steps + image_empty_capped;
+        fprintf(stderr,
+                "%ld steps crossed blocks that can not emit, where the grid "
+                "cap takes about %.0f (%.1f%% fewer steps)\n",
+                image_empty_steps, image_empty_capped,
+                100. * (1. - image_steps / capped));
+    }
+    if (image_rays > 0) {
+        // Every ray takes one evaluation to start, and every step six
+        long attempted = (image_evals - image_rays) / 6;
+        fprintf(stderr,
+                "Dormand-Prince: %ld steps accepted, %ld rejected, %.1f "
+                "evaluations per ray\n",
+                attempted - image_rejected, image_rejected,
+                (double)image_evals / image_rays);
+        fprintf(stderr,
+                "Relative drift of k_t over a ray: %.2e mean, %.2e max\n",
+                image_drift / image_rays, image_drift_max);
     }
-#pragma omp barrier
 }
 
 // Functions that computes a spectrum at every frequency
@@ -0,0 +1,357 @@
+/*
+ * Radboud Polarized Integrator
+ * Copyright 2014-2021 Black Hole Cam (ERC Synergy Grant)
+ * Authors: Thomas Bronzwaer, Jordy Davelaar, Monika Moscibrodzka, Ziri Younsi
+ *
+ * Tabulated kappa and power-law transfer coefficients. At fixed
+ * X = nu / (nu_c sin(theta_B)) the fits scale as n_e B (emission) or n_e / B
+ * (absorption, rotation), so one table per distribution keyed on
+ * (log10 theta_e, log10 X, log cot(theta_B)) holds all of them. The last axis
+ * makes both the sin(theta_B) powers at small pitch angles and the |cos|
+ * powers of the Stokes V fits near pi / 2 linear in log space.
+ * Coefficients are interpolated trilinearly in log space. Points outside the
+ * table, or in cells where a coefficient changes sign, use the direct fits.
+ */
+
+#include "definitions.h"
+#include "functions.h"
+#include "global_vars.h"
+#include "model_definitions.h"
+#include "model_functions.h"
+#include "model_global_vars.h"
+
+#define NTAB_COEFF (8)
+
+typedef struct emis_table_header {
+    char magic[8];
+    int version, df, n[3];
+    double dist_kappa, dist_power, dist_gamma[2], min[3], delta[3];
+} emis_table_header;
+
+typedef struct emis_table {
+    struct emis_table_header header;
+    float *logv;       // log of |coefficient| at n_e = 1, B = 1
+    signed char *sign; // sign of the coefficient, 0 where it vanishes
+} emis_table;
+
+// GLOBAL VARS
+//////////////
+
+struct emis_table emis_table_kappa, emis_table_power;
+
+// FUNCTIONS
+////////////
+
+// Parity of a coefficient under theta_B -> pi - theta_B
+static int tab_parity(int df, int coeff) {
+    if (coeff == TAB_JV || coeff == TAB_RV)
+        return -1;
+    if (coeff == TAB_AV)
+        return (df == KAPPA) ? 1 : -1;
+    return 1;
+}
+
+double emission_direct(int df, int coeff, double theta_e, double n_e,
+                       double nu, double B, double theta_B) {
+    if (df == KAPPA) {
+        switch (coeff) {
+        case TAB_JI:
+            return j_I_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_JQ:
+            return j_Q_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_JV:
+            return j_V_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_AI:
+            return a_I_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_AQ:
+            return a_Q_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_AV:
+            return a_V_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_RQ:
+            return rho_Q_kappa(theta_e, n_e, nu, B, theta_B);
+        case TAB_RV:
+            return rho_V_kappa(theta_e, n_e, nu, B, theta_B);
+        }
+    } else {
+        switch (coeff) {
+        case TAB_JI:
+            return j_I_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_JQ:
+            return j_Q_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_JV:
+            return j_V_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_AI:
+            return a_I_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_AQ:
+            return a_Q_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_AV:
+            return a_V_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_RQ:
+            return rho_Q_power(theta_e, n_e, nu, B, theta_B);
+        case TAB_RV:
+            return rho_V_power(theta_e, n_e, nu, B, theta_B);
+        }
+    }
+    return 0;
+}
+
+// Building and loading the tables, only needed for the distributions that
+// init_emission_tables sets up
+#if (DF == KAPPA || DF == POWER || EMISUSER)
+static void emission_table_fill_header(struct emis_table_header *header,
+                                       int df) {
+    memset(header, 0, sizeof(struct emis_table_header));
+    memcpy(header->magic, "RAPTORET", 8);
+    header->version = 1;
+    header->df = df;
+    header->dist_kappa = kappa;
+    header->dist_power = power;
+    header->dist_gamma[0] = gamma_min;
+    header->dist_gamma[1] = gamma_max;
+
+    // log10 theta_e: the kappa fits need K_n(1 / w), which underflows in GSL
+    // below theta_e ~ 4e-3. The power-law fits do not depend on theta_e.
+    header->n[0] = (df == KAPPA) ? 51 : 1;
+    header->min[0] = -2.;
+    header->delta[0] = 0.1;
+
+    // log10 X
+    header->n[1] = 161;
+    header->min[1] = -4.;
+    header->delta[1] = 0.125;
+
+    // log cot(theta_B), theta_B from 2.5e-3 to pi / 2 - 1e-3
+    header->n[2] = 105;
+    header->min[2] = -7.;
+    header->delta[2] = 0.125;
+}
+
+static size_t emission_table_size(struct emis_table *table) {
+    return (size_t)NTAB_COEFF * table->header.n[0] * table->header.n[1] *
+           table->header.n[2];
+}
+
+static int emission_table_load(struct emis_table *table, const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+
+    struct emis_table_header header;
+    size_t size = emission_table_size(table);
+    int valid =
+        fread(&header, sizeof(struct emis_table_header), 1, file) == 1 &&
+        memcmp(&header, &table->header, sizeof(struct emis_table_header)) ==
+            0 &&
+        fread(table->logv, sizeof(float), size, file) == size &&
+        fread(table->sign, sizeof(signed char), size, file) == size;
+    fclose(file);
+
+    if (!valid)
+        fprintf(stderr,
+                "Emission table %s was made with different settings, "
+                "rebuilding it\n",
+                filename);
+    return valid;
+}
+
+static void emission_table_save(struct emis_table *table,
+                                const char *filename) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot write emission table %s\n", filename);
+        return;
+    }
+
+    size_t size = emission_table_size(table);
+    fwrite(&table->header, sizeof(struct emis_table_header), 1, file);
+    fwrite(table->logv, sizeof(float), size, file);
+    fwrite(table->sign, sizeof(signed char), size, file);
+    fclose(file);
+}
+
+static void emission_table_build(struct emis_table *table) {
+    struct emis_table_header *h = &table->header;
+    double nuc = ELECTRON_CHARGE / (2. * M_PI * ELECTRON_MASS * SPEED_OF_LIGHT);
+
+#pragma omp parallel for collapse(2) schedule(dynamic, 1)
+    for (int it = 0; it < h->n[0]; it++) {
+        for (int ix = 0; ix < h->n[1]; ix++) {
+            double theta_e = pow(10., h->min[0] + it * h->delta[0]);
+            double X = pow(10., h->min[1] + ix * h->delta[1]);
+            for (int ia = 0; ia < h->n[2]; ia++) {
+                double theta_B = atan(exp(-h->min[2] - ia * h->delta[2]));
+                double nu = X * nuc * sin(theta_B);
+
+                for (int coeff = 0; coeff < NTAB_COEFF; coeff++) {
+                    double value = emission_direct(h->df, coeff, theta_e, 1.,
+                                                   nu, 1., theta_B);
+
+                    size_t index =
+                        ((size_t)(coeff * h->n[0] + it) * h->n[1] + ix) *
+                            h->n[2] +
+                        ia;
+                    if (isfinite(value) && value != 0.) {
+                        table->sign[index] = sign(value);
+                        table->logv[index] = log(fabs(value));
+                    } else {
+                        table->sign[index] = 0;
+                        table->logv[index] = 0.;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Compares the table against the direct fits at cell centres and reports the
+// largest relative error per coefficient, once after the table is built
+static void emission_table_check(struct emis_table *table) {
+    struct emis_table_header *h = &table->header;
+    const char *names[NTAB_COEFF] = {"j_I", "j_Q", "j_V",   "a_I",
+                                     "a_Q", "a_V", "rho_Q", "rho_V"};
+    double nuc = ELECTRON_CHARGE / (2. * M_PI * ELECTRON_MASS * SPEED_OF_LIGHT);
+    double max_err[NTAB_COEFF] = {0};
+    int it_max = (h->n[0] > 1) ? h->n[0] - 1 : 1;
+
+    for (int coeff = 0; coeff < NTAB_COEFF; coeff++) {
+        double err = 0;
+#pragma omp parallel for collapse(2) reduction(max : err)
+        for (int it = 0; it < it_max; it++) {
+            for (int ix = 0; ix < h->n[1] - 1; ix += 3) {
+                double theta_e =
+                    pow(10., h->min[0] + (it + 0.5 * (h->n[0] > 1)) *
+                                             h->delta[0]);
+                double X = pow(10., h->min[1] + (ix + 0.5) * h->delta[1]);
+                for (int ia = 0; ia < h->n[2] - 1; ia += 2) {
+                    double theta_B =
+                        atan(exp(-h->min[2] - (ia + 0.5) * h->delta[2]));
+                    double nu = X * nuc * sin(theta_B);
+                    double direct = emission_direct(h->df, coeff, theta_e, 1.,
+                                                    nu, 1., theta_B);
+                    double tab = emission_table(h->df, coeff, theta_e, 1., nu,
+                                                1., theta_B);
+                    if (isfinite(direct) && direct != 0.) {
+                        double rel = fabs(tab / direct - 1.);
+                        if (rel > err)
+                            err = rel;
+                    }
+                }
+            }
+        }
+        max_err[coeff] = err;
+    }
+
+    fprintf(stderr, "Emission table %s: %d x %d x %d, largest relative error\n",
+            h->df == KAPPA ? "kappa" : "power-law", h->n[0], h->n[1], h->n[2]);
+    for (int coeff = 0; coeff < NTAB_COEFF; coeff++)
+        fprintf(stderr, "  %-6s %.2e\n", names[coeff], max_err[coeff]);
+}
+
+static void emission_table_setup(struct emis_table *table, int df) {
+    char filename[256];
+    emission_table_fill_header(&table->header, df);
+
+    size_t size = emission_table_size(table);
+    table->logv = (float *)malloc(size * sizeof(float));
+    table->sign = (signed char *)malloc(size * sizeof(signed char));
+    if (table->logv == NULL || table->sign == NULL) {
+        fprintf(stderr, "Cannot allocate emission table\n");
+        exit(1);
+    }
+
+    snprintf(filename, sizeof(filename), "%s_%s.bin", EMIS_TABLE_FILE,
+             df == KAPPA ? "kappa" : "power");
+
+    if (!emission_table_load(table, filename)) {
+        fprintf(stderr, "\nBuilding emission table %s...\n", filename);
+        emission_table_build(table);
+        emission_table_check(table);
+        emission_table_save(table, filename);
+    }
+}
+#endif
+
+// Builds or loads the tables of the distributions used by the run
+void init_emission_tables() {
+    emis_table_kappa.logv = NULL;
+    emis_table_power.logv = NULL;
+
+#if (DF == KAPPA || EMISUSER)
+    emission_table_setup(&emis_table_kappa, KAPPA);
+#endif
+#if (DF == POWER)
+    emission_table_setup(&emis_table_power, POWER);
+#endif
+}
+
+// Returns coefficient coeff (TAB_JI ... TAB_RV) of distribution df
+double emission_table(int df, int coeff, double theta_e, double n_e, double nu,
+                      double B, double theta_B) {
+    struct emis_table *table =
+        (df == KAPPA) ? &emis_table_kappa : &emis_table_power;
+    struct emis_table_header *h = &table->header;
+
+    if (table->logv == NULL)
+        return emission_direct(df, coeff, theta_e, n_e, nu, B, theta_B);
+
+    double parity = 1.;
+    double th = theta_B;
+    if (th > M_PI / 2.) {
+        th = M_PI - th;
+        parity = tab_parity(df, coeff);
+    }
+
+    double sin_th = sin(th);
+    double cos_th = cos(th);
+    double nuc =
+        ELECTRON_CHARGE * B / (2. * M_PI * ELECTRON_MASS * SPEED_OF_LIGHT);
+    double u[3] = {log10(theta_e), log10(nu / (nuc * sin_th)),
+                   log(cos_th / sin_th)};
+
+    int i[3];
+    double f[3];
+    size_t stride[3] = {(size_t)h->n[1] * h->n[2], h->n[2], 1};
+    for (int d = 0; d < 3; d++) {
+        if (h->n[d] == 1) {
+            i[d] = 0;
+            f[d] = 0.;
+            stride[d] = 0;
+            continue;
+        }
+        double x = (u[d] - h->min[d]) / h->delta[d];
+        if (!(x >= 0. && x <= h->n[d] - 1))
+            return emission_direct(df, coeff, theta_e, n_e, nu, B, theta_B);
+        i[d] = (int)x;
+        if (i[d] > h->n[d] - 2)
+            i[d] = h->n[d] - 2;
+        f[d] = x - i[d];
+    }
+
+    size_t base = ((size_t)(coeff * h->n[0] + i[0]) * h->n[1] + i[1]) * h->n[2] +
+                  i[2];
+    double logv = 0.;
+    int s = table->sign[base];
+    int zeros = 0;
+    for (int c = 0; c < 8; c++) {
+        size_t index = base + ((c & 1) ? stride[0] : 0) +
+                       ((c & 2) ? stride[1] : 0) + ((c & 4) ? stride[2] : 0);
+        double w = ((c & 1) ? f[0] : 1. - f[0]) *
+                   ((c & 2) ? f[1] : 1. - f[1]) * ((c & 4) ? f[2] : 1. - f[2]);
+        zeros += (table->sign[index] == 0);
+        if (table->sign[index] != s)
+            s = 2;
+        logv += w * table->logv[index];
+    }
+
+    if (zeros == 8)
+        return 0.;
+    if (s == 2 || s == 0)
+        return emission_direct(df, coeff, theta_e, n_e, nu, B, theta_B);
+
+    double value = s * exp(logv);
+
+    if (coeff == TAB_JI || coeff == TAB_JQ || coeff == TAB_JV)
+        return parity * value * n_e * B;
+    else
+        return parity * value * n_e / B;
+}
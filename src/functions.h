@@ -17,6 +17,25 @@
 
 void read_model(char *argv[]);
 
+// GEO_CACHE.C
+//////////////
+
+// Maps the on-disk geodesic store and opens it for appending
+void geo_cache_init();
+
+// Returns the store entry of a camera block, -1 if it is not stored
+int geo_cache_find(struct Camera *intensityfield);
+
+// Returns the stored lightpath and number of steps of a pixel
+double *geo_cache_lightpath(int entry, int pixel, int *steps);
+
+// Appends the lightpaths of a camera block to the store
+void geo_cache_store(struct Camera *intensityfield, double **lightpath,
+                     int *steps);
+
+// Reports reuse statistics and unmaps the store
+void geo_cache_close();
+
 // GRMATH.C
 ///////////
 
@@ -65,6 +84,12 @@ void CKS_to_KS(double *X_CKS_u, double *X_KS_u);
 // Transform a contravariant vector from KS to CKS coordinates
 void KS_to_CKS_u(double *KScoords, double *CKScoords);
 
+// Transform a photon from BL to the coordinates in use
+void BL_to_code_u(double *BLphoton_u, double *photon_u);
+
+// Transform a photon from the coordinates in use back to BL
+void code_to_BL_u(double *photon_u, double *BLphoton_u);
+
 // Return the photon frequency in the co-moving frame of the plasma
 double freq_in_plasma_frame(double Uplasma_u[4], double k_d[4]);
 
@@ -79,6 +104,10 @@ double pitch_angle(double *X_u, double *k_u, double *B_u, double *Uplasma_u);
 
 // void construct_U_vector( double X_u[], double U_u[]);
 
+// Trilinear interpolation of n consecutive fields stored at the eight
+// corners of a stencil
+void interp_fields(double *corner[8], int n, double del[4], double *out);
+
 // INTEGRATOR.C
 ///////////////
 
@@ -98,21 +127,130 @@ void verlet_step(double *y, void (*f)(double *, double *), double dl);
 // y contains the 4-position and the 4-velocity for one lightray/particle
 void f_geodesic(double *y, double *fvector);
 
+// Takes one accepted Dormand-Prince 5(4) step of y with FSAL derivative f_y,
+// step size control and dense output; returns the size of the step taken
+double dopri5_step(double *y, double *f_y, void (*f)(double *, double *),
+                   double *h, double *err_old, double rcont[5][DIM * 2]);
+
+// Evaluates the dense output of a Dormand-Prince step at fraction theta
+void dopri5_dense(double rcont[5][DIM * 2], double theta, double *y);
+
+// Sets up the Mino-time state y and constants EQL = {E, L, Q} of a photon
+void mino_init(double photon_u[8], double y[7], double EQL[3]);
+
+// Mino-time derivatives of the first-order Kerr geodesic equations
+void f_mino(double y[7], double EQL[3], double dy[7]);
+
+// Advances photon_u by one Mino-time RK4 step of about dlambda
+void mino_step(double photon_u[8], double y[7], double EQL[3],
+               double *dlambda);
+
+// Grow a lightpath buffer
+void grow_lightpath(double **lightpath, int *capacity);
+
+// State of a ray between calls of geodesic_advance
+typedef struct Ray {
+    double alpha, beta;  // impact parameters
+    double photon_u[8];  // current position and wave vector
+    double lambda;       // affine parameter
+    double r_outer;      // outer cutoff
+    double thetadot_prev;
+    int theta_turns;
+    int steps;     // lightpath entries so far
+    int terminate; // ray ends after its next step
+    int done;      // ray has ended
+#if (int_method == MINO)
+    double mino_y[7], EQL[3];
+#endif
+#if (int_method == DOPRI5)
+    double dp_y[8], dp_f[8], dp_rcont[5][8], dp_k_d[4];
+    double dp_h, dp_err_old, dp_lambda_a, dp_lambda_b;
+#endif
+} Ray;
+
+// Sets up the null geodesic of the camera ray at alpha, beta
+void geodesic_start(double alpha, double beta, struct Ray *ray,
+                    double **lightpath_buffer, int *capacity, int *steps);
+
+// Takes the next step of a geodesic and writes its lightpath entry; returns 0
+// once the ray has ended
+int geodesic_step(struct Ray *ray, double lightpath_entry[9],
+                  double cutoff_inner);
+
+// Continues a geodesic until it ends or the lightpath holds stop_steps steps
+void geodesic_advance(struct Ray *ray, double **lightpath_buffer,
+                      int *capacity, int *steps, int stop_steps,
+                      double cutoff_inner);
+
 // Integrate the null geodesic specified by alpha and beta, store results
 // in lightpath
-void integrate_geodesic(double alpha, double beta, double *lightpath,
-                        int *steps, double cutoff_inner);
-
+void integrate_geodesic(double alpha, double beta, double **lightpath_buffer,
+                        int *capacity, int *steps, double cutoff_inner);
+
+// The function to be used by the packet integrator, for RAY_PACKET rays
+// stored lane by lane as y[i][lane]
+void f_geodesic_packet(double y[DIM * 2][RAY_PACKET],
+                       double fvector[DIM * 2][RAY_PACKET]);
+
+// Updates a packet of rays by one RK4 (or RK2) step of dt[lane] per lane
+void rk_step_packet(double y[DIM * 2][RAY_PACKET], double dt[RAY_PACKET]);
+
+// Integrate the null geodesics of RAY_PACKET camera rays in lockstep, one
+// lightpath per active lane
+void integrate_geodesic_packet(double alpha[RAY_PACKET],
+                               double beta[RAY_PACKET],
+                               int active[RAY_PACKET],
+                               double *lightpath_buffer[RAY_PACKET],
+                               int capacity[RAY_PACKET],
+                               int steps[RAY_PACKET], double cutoff_inner);
+
+// Polarized radiative transfer along the lightpath, all frequencies are
+// transferred in a single pass
 void radiative_transfer_polarized(double *lightpath, int steps,
-                                  double frequency, double *f_x, double *f_y,
-                                  double *p, int PRINT_POLAR, double *IQUV,
-                                  double *tau, double *tauF);
+                                  double *frequency, double *f_x, double *f_y,
+                                  double *p, int PRINT_POLAR,
+                                  double IQUV[num_frequencies][4],
+                                  double tau[num_frequencies],
+                                  double tauF[num_frequencies]);
 
 double radiative_transfer_unpolarized(double *lightpath, int steps,
                                       double *frequency,
                                       double IQUV[num_frequencies][4],
                                       double I_radial_cut[num_frequencies][5],
                                       double tau[num_frequencies]);
+
+// State of the observer-to-source transfer of a ray
+typedef struct Transfer {
+    double *frequency;
+    double (*IQUV)[4];
+    double (*I_radial_cut)[5];
+    double *tau;
+    double trans_front[num_frequencies]; // transmittance in front of the ray
+    struct GRMHD modvar;                 // plasma at the last point
+} Transfer;
+
+// Starts the observer-to-source transfer of a ray
+void transfer_start(struct Transfer *rt, double *frequency,
+                    double IQUV[num_frequencies][4],
+                    double I_radial_cut[num_frequencies][5],
+                    double tau[num_frequencies]);
+
+// Adds a step of dl_current ending at X_u, k_u to the observer-to-source
+// transfer; returns 1 once tau exceeds TAU_STOP at all frequencies
+int transfer_step(struct Transfer *rt, double X_u[4], double k_u[4],
+                  double dl_current);
+
+// Unpolarized transfer of lightpath steps first to steps - 1 from the
+// observer towards the source; returns 1 once tau exceeds TAU_STOP at all
+// frequencies
+int radiative_transfer_observer(double *lightpath, int first, int steps,
+                                double *frequency,
+                                double IQUV[num_frequencies][4],
+                                double I_radial_cut[num_frequencies][5],
+                                double tau[num_frequencies]);
+
+int radial_band(double r);
+
 // METRIC.C
 ///////////
 
@@ -131,10 +269,36 @@ void connection_num_udd(double X_u[4], double gamma_udd[4][4][4]);
 // Computes the Christoffel symbols at location X based on an exact metric
 void connection_udd(double X_u[4], double gamma_udd[4][4][4]);
 
+// Checks connection_udd against connection_num_udd away from the horizon
+// (CKS only)
+void check_connection();
+
+// Returns the geodesic acceleration -Gamma^i_jk U^j U^k at X_u and, if A_f is
+// not NULL, the parallel transport matrix A_f[i][k] = -Gamma^i_jk U^j
+void geodesic_accel(double X_u[4], double U_u[4], double A_u[4],
+                    double A_f[4][4]);
+
+// Geodesic accelerations of RAY_PACKET rays stored lane by lane, X_u[i][lane]
+void geodesic_accel_packet(double X_u[4][RAY_PACKET],
+                           double U_u[4][RAY_PACKET],
+                           double A_u[4][RAY_PACKET]);
+
 // This function initializes a single 'superphoton' or light ray.
-void initialize_photon(double alpha, double beta, double k_u[4], double t_init);
+void initialize_photon(double alpha, double beta, double photon_u[8],
+                       double t_init);
+
+// Builds a photon at a BL position from its covariant k_t, k_theta, k_phi.
+void photon_from_BL(double X_u[4], double k_d[4], double photon_u[8]);
+
+// Initializes a light ray where it first reaches the sphere r_start.
+int initialize_photon_at(double alpha, double beta, double photon_u[8],
+                         double t_init, double r_start, int *theta_turns);
 
 // Transformation functions
+double f_Xg2(double Xg2, double Xr2);
+
+double f_primed_Xg2(double Xg2);
+
 double Xg2_approx_rand(double Xr2);
 
 double Ug2_approx_rand(double Ur2, double Xg2);
@@ -177,7 +341,17 @@ void evaluate_coeffs_user(double *jI, double *jQ, double *jU, double *jV,
 void evaluate_coeffs_single(double *jI, double *jQ, double *jU, double *jV,
                             double *rQ, double *rU, double *rV, double *aI,
                             double *aQ, double *aU, double *aV, double nu_p,
-                            struct GRMHD modvar, double pitch_ang, int rmin, double r_current);
+                            struct GRMHD modvar, double pitch_ang);
+
+void invariant_coeffs(double *jI, double *jQ, double *jU, double *jV,
+                      double *rQ, double *rU, double *rV, double *aI,
+                      double *aQ, double *aU, double *aV, double nu_p);
+
+void evaluate_coeffs_batch(double jI[], double jQ[], double jU[], double jV[],
+                           double rQ[], double rU[], double rV[], double aI[],
+                           double aQ[], double aU[], double aV[],
+                           double nu_p[], int n_nu, struct GRMHD modvar,
+                           double pitch_ang);
 
 // Return emission coefficient j_nu for kappa distribution function
 double emission_coeff_kappa_FIT(double nu, double Ne, double Thetae, double B,
@@ -257,6 +431,23 @@ double rho_Q_kappa(double theta_e, double n_e, double nu, double B,
 double rho_Q_thermal(double theta_e, double n_e, double nu, double B,
                      double theta_B);
 
+double j_I_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double j_Q_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double j_V_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double a_I_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double a_Q_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double a_V_power(double theta_e, double n_e, double nu, double B,
+                 double theta_B);
+double rho_Q_power(double theta_e, double n_e, double nu, double B,
+                   double theta_B);
+double rho_V_power(double theta_e, double n_e, double nu, double B,
+                   double theta_B);
+
 double j_I(double theta_e, double n_e, double nu, double B, double theta_B);
 double j_Q(double theta_e, double n_e, double nu, double B, double theta_B);
 double j_V(double theta_e, double n_e, double nu, double B, double theta_B);
@@ -273,6 +464,34 @@ double a_V(double theta_e, double n_e, double nu, double B, double theta_B,
 double rho_Q(double theta_e, double n_e, double nu, double B, double theta_B);
 double rho_V(double theta_e, double n_e, double nu, double B, double theta_B);
 
+void bessel_K012_scaled(double x, double K[3]);
+
+void thermal_coeffs(double theta_e, double n_e, double B, double theta_B,
+                    const double *nu, int n_nu, double *jI, double *jQ,
+                    double *jV, double *aI, double *aQ, double *aV, double *rQ,
+                    double *rV);
+
+// EMISSION_TABLE.C
+///////////////////
+
+// Coefficients held by the emission tables
+#define TAB_JI (0)
+#define TAB_JQ (1)
+#define TAB_JV (2)
+#define TAB_AI (3)
+#define TAB_AQ (4)
+#define TAB_AV (5)
+#define TAB_RQ (6)
+#define TAB_RV (7)
+
+void init_emission_tables();
+
+double emission_direct(int df, int coeff, double theta_e, double n_e,
+                       double nu, double B, double theta_B);
+
+double emission_table(int df, int coeff, double theta_e, double n_e, double nu,
+                      double B, double theta_B);
+
 // UTILITIES.C
 //////////////
 
@@ -339,12 +558,23 @@ void write_uniform_camera(struct Camera *intensityfield, double frequency,
 // compute the image.
 void calculate_image_block(struct Camera *intensityfield,
                            double frequencies[num_frequencies]);
+
+void calculate_image_blocks(struct Camera *intensityfield, int n_blocks,
+                            double frequencies[num_frequencies]);
+
+void report_image_steps();
 /// CAMERA.C
 void init_camera(struct Camera **intensityfield);
 
 void add_block(struct Camera **intensityfield, int current_block);
 
-int refine_block();
+int refine_block(struct Camera *intensity);
+
+void refine_camera(struct Camera **intensityfield,
+                   double frequencies[num_frequencies]);
+
+int collect_leaves(struct Camera *tree, int *child, int node,
+                   struct Camera *leaves, int n_leaves);
 
 void prerun_refine(struct Camera **intensityfield);
 
@@ -0,0 +1,269 @@
+/*
+ * Radboud Polarized Integrator
+ * Copyright 2014-2021 Black Hole Cam (ERC Synergy Grant)
+ * Authors: Thomas Bronzwaer, Jordy Davelaar, Monika Moscibrodzka, Ziri Younsi
+ *
+ * On-disk store of integrated geodesics. The lightpaths only depend on the
+ * spacetime, the camera and the integrator settings, so runs over different
+ * snapshots, M_UNIT or R_HIGH with the same settings can skip
+ * integrate_geodesic and go straight to radiative transfer. For MKSBHAC the
+ * step size follows the AMR blocks, so their layout is part of the key.
+ *
+ * File layout: a header holding the key, followed by one record per camera
+ * block. A record holds the block level and indices, the number of steps per
+ * pixel and then the lightpaths of all pixels, 9 doubles per step.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "definitions.h"
+#include "functions.h"
+#include "global_vars.h"
+#include "model_definitions.h"
+#include "model_functions.h"
+#include "model_global_vars.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct geo_cache_header {
+    char magic[8];
+    int64_t version, metric_id, int_method_id, pixels_1d, blocks_1d,
+        fast_forward, grid_hash;
+    double spin, inclination, stepsize, cam_size[2], r_cam, cutoff_inner,
+        rt_outer_cutoff, steps_max, rtol, atol, ff_radius;
+} geo_cache_header;
+
+typedef struct geo_cache_record {
+    int64_t level, ind[2];
+    int64_t steps[tot_pixels];
+} geo_cache_record;
+
+typedef struct geo_cache_entry {
+    int level, ind[2];
+    int steps[tot_pixels];
+    double *lightpath[tot_pixels];
+} geo_cache_entry;
+
+// GLOBAL VARS
+//////////////
+
+void *geo_cache_map;
+size_t geo_cache_map_size;
+struct geo_cache_entry *geo_cache_index;
+int geo_cache_entries;
+int geo_cache_fd;
+int geo_cache_hits, geo_cache_misses;
+
+// FUNCTIONS
+////////////
+
+void geo_cache_fill_header(struct geo_cache_header *header) {
+    memset(header, 0, sizeof(struct geo_cache_header));
+    memcpy(header->magic, "RAPTORGC", 8);
+    header->version = 4;
+    header->metric_id = metric;
+    header->int_method_id = int_method;
+    header->pixels_1d = num_pixels_1d;
+    header->blocks_1d = num_blocks;
+    header->spin = a;
+    header->inclination = INCLINATION;
+    header->stepsize = STEPSIZE;
+    header->cam_size[0] = CAM_SIZE_X;
+    header->cam_size[1] = CAM_SIZE_Y;
+    header->r_cam = rcam;
+    header->cutoff_inner = CUTOFF_INNER;
+    header->rt_outer_cutoff = RT_OUTER_CUTOFF;
+    header->steps_max = max_steps_hard;
+#if (int_method == DOPRI5)
+    header->rtol = RTOL;
+    header->atol = ATOL;
+#endif
+#if (metric == MKSBHAC)
+    // The step size follows the AMR blocks of the loaded snapshot
+    header->grid_hash = (int64_t)block_layout_hash();
+#endif
+#if (FAST_FORWARD)
+    header->fast_forward = 1;
+    header->ff_radius = FF_RADIUS;
+#endif
+}
+
+// Maps an existing store if its key matches the current run, and opens the
+// store for appending newly integrated blocks.
+void geo_cache_init() {
+    struct geo_cache_header header;
+    geo_cache_fill_header(&header);
+
+    geo_cache_map = NULL;
+    geo_cache_map_size = 0;
+    geo_cache_index = NULL;
+    geo_cache_entries = 0;
+    geo_cache_hits = 0;
+    geo_cache_misses = 0;
+
+    int valid = 0;
+    int complete = 1;
+
+    int fd = open(GEO_CACHE_FILE, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        fstat(fd, &st);
+        if (st.st_size >= (off_t)sizeof(struct geo_cache_header)) {
+            geo_cache_map_size = st.st_size;
+            geo_cache_map =
+                mmap(NULL, geo_cache_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (geo_cache_map == MAP_FAILED) {
+                geo_cache_map = NULL;
+            } else if (memcmp(geo_cache_map, &header,
+                              sizeof(struct geo_cache_header)) == 0) {
+                valid = 1;
+            } else {
+                fprintf(stderr,
+                        "Geodesic cache %s was made with different settings, "
+                        "rebuilding it\n",
+                        GEO_CACHE_FILE);
+                munmap(geo_cache_map, geo_cache_map_size);
+                geo_cache_map = NULL;
+            }
+        }
+        close(fd);
+    }
+
+    if (valid) {
+        char *base = (char *)geo_cache_map;
+        size_t offset = sizeof(struct geo_cache_header);
+        int size = 0;
+
+        while (offset + sizeof(struct geo_cache_record) <= geo_cache_map_size) {
+            struct geo_cache_record *record =
+                (struct geo_cache_record *)(base + offset);
+            size_t path_bytes = 0;
+            for (int pixel = 0; pixel < tot_pixels; pixel++)
+                path_bytes += 9 * record->steps[pixel] * sizeof(double);
+
+            if (offset + sizeof(struct geo_cache_record) + path_bytes >
+                geo_cache_map_size) {
+                complete = 0;
+                break;
+            }
+
+            if (geo_cache_entries == size) {
+                size = 2 * size + 16;
+                geo_cache_index = (struct geo_cache_entry *)realloc(
+                    geo_cache_index, size * sizeof(struct geo_cache_entry));
+            }
+
+            struct geo_cache_entry *entry = &geo_cache_index[geo_cache_entries];
+            entry->level = record->level;
+            entry->ind[0] = record->ind[0];
+            entry->ind[1] = record->ind[1];
+
+            double *path = (double *)(base + offset +
+                                      sizeof(struct geo_cache_record));
+            for (int pixel = 0; pixel < tot_pixels; pixel++) {
+                entry->steps[pixel] = record->steps[pixel];
+                entry->lightpath[pixel] = path;
+                path += 9 * record->steps[pixel];
+            }
+
+            geo_cache_entries++;
+            offset += sizeof(struct geo_cache_record) + path_bytes;
+        }
+
+        fprintf(stderr, "\nGeodesic cache %s: %d blocks available\n",
+                GEO_CACHE_FILE, geo_cache_entries);
+    }
+
+    if (!complete) {
+        // Appending behind a partial record would corrupt the store
+        fprintf(stderr,
+                "Geodesic cache %s ends in a partial block, new blocks are not "
+                "stored. Remove the file to rebuild it.\n",
+                GEO_CACHE_FILE);
+        geo_cache_fd = -1;
+    } else if (valid) {
+        geo_cache_fd = open(GEO_CACHE_FILE, O_WRONLY | O_APPEND);
+    } else {
+        geo_cache_fd =
+            open(GEO_CACHE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (geo_cache_fd >= 0 &&
+            write(geo_cache_fd, &header, sizeof(struct geo_cache_header)) !=
+                sizeof(struct geo_cache_header)) {
+            close(geo_cache_fd);
+            geo_cache_fd = -1;
+        }
+    }
+
+    if (geo_cache_fd < 0 && complete)
+        fprintf(stderr, "Cannot write geodesic cache %s\n", GEO_CACHE_FILE);
+}
+
+// Returns the cache entry of a camera block, -1 if it is not stored
+int geo_cache_find(struct Camera *intensityfield) {
+    for (int entry = 0; entry < geo_cache_entries; entry++) {
+        if (geo_cache_index[entry].level == (*intensityfield).level &&
+            geo_cache_index[entry].ind[0] == (*intensityfield).ind[0] &&
+            geo_cache_index[entry].ind[1] == (*intensityfield).ind[1]) {
+            geo_cache_hits++;
+            return entry;
+        }
+    }
+    geo_cache_misses++;
+    return -1;
+}
+
+// Returns a read-only pointer to the stored lightpath of a pixel
+double *geo_cache_lightpath(int entry, int pixel, int *steps) {
+    *steps = geo_cache_index[entry].steps[pixel];
+    return geo_cache_index[entry].lightpath[pixel];
+}
+
+// Appends the lightpaths of a camera block to the store
+void geo_cache_store(struct Camera *intensityfield, double **lightpath,
+                     int *steps) {
+    if (geo_cache_fd < 0)
+        return;
+
+    struct geo_cache_record record;
+    record.level = (*intensityfield).level;
+    record.ind[0] = (*intensityfield).ind[0];
+    record.ind[1] = (*intensityfield).ind[1];
+
+    size_t bytes = sizeof(struct geo_cache_record);
+    for (int pixel = 0; pixel < tot_pixels; pixel++) {
+        record.steps[pixel] = steps[pixel];
+        bytes += 9 * steps[pixel] * sizeof(double);
+    }
+
+    // A single write per block keeps records whole when runs share a store
+    char *buffer = malloc(bytes);
+    memcpy(buffer, &record, sizeof(struct geo_cache_record));
+    char *path = buffer + sizeof(struct geo_cache_record);
+    for (int pixel = 0; pixel < tot_pixels; pixel++) {
+        memcpy(path, lightpath[pixel], 9 * steps[pixel] * sizeof(double));
+        path += 9 * steps[pixel] * sizeof(double);
+    }
+
+    if (write(geo_cache_fd, buffer, bytes) != (ssize_t)bytes) {
+        fprintf(stderr, "Writing geodesic cache %s failed, stop storing\n",
+                GEO_CACHE_FILE);
+        close(geo_cache_fd);
+        geo_cache_fd = -1;
+    }
+
+    free(buffer);
+}
+
+void geo_cache_close() {
+    fprintf(stderr, "\nGeodesic cache: %d blocks reused, %d blocks integrated\n",
+            geo_cache_hits, geo_cache_misses);
+
+    if (geo_cache_fd >= 0)
+        close(geo_cache_fd);
+    if (geo_cache_map)
+        munmap(geo_cache_map, geo_cache_map_size);
+    free(geo_cache_index);
+}
@@ -34,6 +34,17 @@ extern double SOURCE_DIST; // Distance to M87 (cm); for Sgr A* use (2.47e22)
 extern int IMG_WIDTH, IMG_HEIGHT;
 extern double CAM_SIZE_X, CAM_SIZE_Y;
 extern double STEPSIZE;
+extern double RTOL, ATOL;
+
+// GR_INTEGRATOR.C
+//////////////////
+
+#if (int_method == DOPRI5)
+extern long dopri_rays, dopri_rejected, dopri_evals;
+extern double dopri_drift_sum, dopri_drift_max;
+#pragma omp threadprivate(dopri_rays, dopri_rejected, dopri_evals,            \
+                          dopri_drift_sum, dopri_drift_max)
+#endif
 
 // CONSTANTS.C
 //////////////
@@ -12,6 +12,24 @@
 #include "model_functions.h"
 #include "model_global_vars.h"
 
+#if (metric == MKSBHAC && SKIP_EMPTY_BLOCKS)
+// Steps each thread took through blocks that can not emit, and the number of
+// grid capped steps they stand in for
+long empty_steps = 0;
+double empty_steps_capped = 0.;
+#pragma omp threadprivate(empty_steps, empty_steps_capped)
+#endif
+
+#if (int_method == DOPRI5)
+// Dormand-Prince statistics of each thread: rays integrated, rejected steps,
+// derivative evaluations, and the summed and largest relative drift of the
+// conserved k_t over a ray
+long dopri_rays = 0, dopri_rejected = 0, dopri_evals = 0;
+double dopri_drift_sum = 0., dopri_drift_max = 0.;
+#pragma omp threadprivate(dopri_rays, dopri_rejected, dopri_evals,            \
+                          dopri_drift_sum, dopri_drift_max)
+#endif
+
 // FUNCTIONS
 ////////////
 
@@ -246,6 +264,119 @@ void verlet_step(double *y, void (*f)(double *, double *), double dl) {
     }
 }
 
+#if (int_method == DOPRI5)
+// Takes one accepted Dormand-Prince 5(4) step of y. The derivative f_y at y
+// is the last stage of the previous step (FSAL) and is updated to the one at
+// the new y. The step *h is shrunk until the error meets RTOL and ATOL, and
+// on return holds the step the PI controller proposes next. The dense output
+// of the step is left in rcont. Returns the size of the step taken
+// Ref. HAIRER, NORSETT & WANNER 1993, section II.5 and code DOPRI5
+double dopri5_step(double *y, double *f_y, void (*f)(double *, double *),
+                   double *h, double *err_old, double rcont[5][DIM * 2]) {
+    // Butcher tableau; the last row is the 5th order solution, and e_j the
+    // difference with the embedded 4th order one
+    const double a_ij[6][6] = {
+        {1. / 5.},
+        {3. / 40., 9. / 40.},
+        {44. / 45., -56. / 15., 32. / 9.},
+        {19372. / 6561., -25360. / 2187., 64448. / 6561., -212. / 729.},
+        {9017. / 3168., -355. / 33., 46732. / 5247., 49. / 176.,
+         -5103. / 18656.},
+        {35. / 384., 0., 500. / 1113., 125. / 192., -2187. / 6784.,
+         11. / 84.}};
+    const double e_j[7] = {71. / 57600.,  0.,         -71. / 16695.,
+                           71. / 1920.,   -17253. / 339200.,
+                           22. / 525.,    -1. / 40.};
+    // Coefficients of the 4th order continuous extension
+    const double d_j[7] = {-12715105075. / 11282082432., 0.,
+                           87487479700. / 32700410799.,
+                           -10690763975. / 1880347072.,
+                           701980252875. / 199316789632.,
+                           -1453857185. / 822651844., 69997945. / 29380423.};
+
+    // PI controller: safety factor, step change limits and the weight of
+    // the previous error
+    const double safe = 0.9, fac_min = 0.2, fac_max = 10., beta = 0.04;
+    const double h_min = 1.e-10;
+
+    double k[7][DIM * 2], yshift[DIM * 2];
+    int i, j, s;
+    int rejected = 0;
+
+    for (i = 0; i < DIM * 2; i++)
+        k[0][i] = f_y[i];
+
+    while (1) {
+        for (s = 1; s < 7; s++) {
+            for (i = 0; i < DIM * 2; i++) {
+                double dy = 0.;
+                for (j = 0; j < s; j++)
+                    dy += a_ij[s - 1][j] * k[j][i];
+                yshift[i] = y[i] + (*h) * dy;
+            }
+            f(yshift, k[s]);
+        }
+        dopri_evals += 6;
+
+        // Error of the step, relative to the tolerances
+        double err = 0.;
+        for (i = 0; i < DIM * 2; i++) {
+            double sk = ATOL + RTOL * fmax(fabs(y[i]), fabs(yshift[i]));
+            double ei = 0.;
+            for (j = 0; j < 7; j++)
+                ei += e_j[j] * k[j][i];
+            ei *= (*h) / sk;
+            err += ei * ei;
+        }
+        err = sqrt(err / (DIM * 2));
+
+        double fac11 = pow(err, 0.2 - 0.75 * beta);
+        if (err <= 1. || fabs(*h) <= h_min) {
+            double fac = fac11 / pow(*err_old, beta);
+            fac = fmax(1. / fac_max, fmin(1. / fac_min, fac / safe));
+            double h_new = (*h) / fac;
+            // No growth right after a rejection
+            if (rejected)
+                h_new = copysign(fmin(fabs(h_new), fabs(*h)), *h);
+            *err_old = fmax(err, 1.e-4);
+
+            for (i = 0; i < DIM * 2; i++) {
+                double dy = 0.;
+                for (j = 0; j < 7; j++)
+                    dy += d_j[j] * k[j][i];
+                rcont[0][i] = y[i];
+                rcont[1][i] = yshift[i] - y[i];
+                rcont[2][i] = (*h) * k[0][i] - rcont[1][i];
+                rcont[3][i] = rcont[1][i] - (*h) * k[6][i] - rcont[2][i];
+                rcont[4][i] = (*h) * dy;
+                y[i] = yshift[i];
+                f_y[i] = k[6][i];
+            }
+
+            double h_done = fabs(*h);
+            *h = h_new;
+            return h_done;
+        }
+
+        dopri_rejected++;
+        rejected = 1;
+        *h /= fmin(1. / fac_min, fac11 / safe);
+    }
+}
+
+// Evaluates the dense output of the last Dormand-Prince step at the fraction
+// theta of the step
+void dopri5_dense(double rcont[5][DIM * 2], double theta, double *y) {
+    double theta1 = 1. - theta;
+    for (int i = 0; i < DIM * 2; i++)
+        y[i] = rcont[0][i] +
+               theta * (rcont[1][i] +
+                        theta1 * (rcont[2][i] +
+                                  theta * (rcont[3][i] +
+                                           theta1 * rcont[4][i])));
+}
+#endif
+
 // Returns an appropriate stepsize dlambda, which depends on position &
 // velocity Ref. DOLENCE & MOSCIBRODZKA 2009
 double stepsize(double X_u[4], double U_u[4]) {
@@ -277,8 +408,12 @@ double stepsize(double X_u[4], double U_u[4]) {
 #if(metric==MKSBHAC)
 
        double step_grid =1e100;
+#if (SKIP_EMPTY_BLOCKS)
+       double step_cap = 0.;
+#endif
        if(exp(X_u[1])<RT_OUTER_CUTOFF){
-           int igrid = find_igrid(X_u, block_info, Xgrid);
+           int igrid = find_igrid(X_u, block_info);
+           if (igrid >= 0) {
 	   double step1 = block_info[igrid].dxc_block[0]/(fabs(U_u[1]) + SMALL * SMALL);
            double step2 = block_info[igrid].dxc_block[1]/(fabs(U_u[2]) + SMALL * SMALL);
            double step3 = block_info[igrid].dxc_block[2]/(fabs(U_u[3]) + SMALL * SMALL);
@@ -288,8 +423,24 @@ double stepsize(double X_u[4], double U_u[4]) {
            double minstep = 1/(istep1+istep2+istep3);
 
            step_grid =  minstep/4.;
+#if (SKIP_EMPTY_BLOCKS)
+           // Nothing in this block emits, so the ray only has to stop just
+           // past its boundary for the cap to apply again in the next block
+           if (!block_emits[igrid]) {
+               step_cap = step_grid;
+               step_grid = block_exit_step(X_u, U_u, igrid) + minstep / 4.;
+           }
+#endif
+           }
         }
         double step = fmin(1/ (idlx1 + idlx2 + idlx3), step_grid);
+#if (SKIP_EMPTY_BLOCKS)
+        if (step_cap > 0.) {
+            empty_steps++;
+            empty_steps_capped +=
+                step / fmin(1 / (idlx1 + idlx2 + idlx3), step_cap);
+        }
+#endif
         return -step;
 
 #else
@@ -304,24 +455,14 @@ double stepsize(double X_u[4], double U_u[4]) {
 // The function to be used by the integrator for GR geodesic calculations.
 // y contains the 4-position and the 4-velocity for one lightray/particle.
 void f_geodesic(double *y, double *fvector) {
-    // Create variable (on the stack) for the connection
-    double gamma_udd[4][4][4];
-
     // Initialize position, four-velocity, and four-acceleration vectors
     // based on values of y
     double X_u[4] = {y[0], y[1], y[2], y[3]}; // X
     double U_u[4] = {y[4], y[5], y[6], y[7]}; // dX/dLambda
-    double A_u[4] = {0., 0., 0., 0.};         // d^2X/dLambda^2
+    double A_u[4];                            // d^2X/dLambda^2
 
-    // Obtain the Christoffel symbols at the current location
-#if (metric == MKSBHAC || metric == MKSHARM)
-    connection_udd(X_u, gamma_udd);
-#else
-    connection_num_udd(X_u, gamma_udd);
-#endif
     // Compute 4-acceleration using the geodesic equation
-    // Einstein summation over indices v and w
-    LOOP_ijk A_u[i] -= gamma_udd[i][j][k] * U_u[j] * U_u[k];
+    geodesic_accel(X_u, U_u, A_u, NULL);
 
     // Update fvector
     LOOP_i {
@@ -330,84 +471,293 @@ void f_geodesic(double *y, double *fvector) {
     }
 }
 
-// Integrate the null geodesic defined by "photon_u"
-void integrate_geodesic(double alpha, double beta, double *lightpath,
-                        int *steps, double cutoff_inner) {
-    int q;
+// Sets up the Mino-time state of a photon for int_method MINO:
+// y = {r, dr/dlambda_M, u = cos(theta), du/dlambda_M, phi, t, lambda} in BL,
+// where dlambda = Sigma dlambda_M, and its constants of motion
+// EQL = {E, L, Q}
+void mino_init(double photon_u[8], double y[7], double EQL[3]) {
+    double BLphoton_u[8];
+    code_to_BL_u(photon_u, BLphoton_u);
+
+    double r = logscale ? exp(BLphoton_u[1]) : BLphoton_u[1];
+    double rfactor = logscale ? r : 1.;
+    double sint = sin(BLphoton_u[2]);
+    double cost = cos(BLphoton_u[2]);
+    double sigma = r * r + a * a * cost * cost;
+    double delta = r * r + a * a - 2. * r;
+
+    // Covariant k_t and k_phi from the BL metric
+    double g_dd_00 = -(1. - 2. * r / sigma);
+    double g_dd_03 = -2. * a * r * sint * sint / sigma;
+    double g_dd_33 = ((r * r + a * a) * (r * r + a * a) -
+                      delta * a * a * sint * sint) *
+                     sint * sint / sigma;
+    double En = -(g_dd_00 * BLphoton_u[4] + g_dd_03 * BLphoton_u[7]);
+    double L = g_dd_03 * BLphoton_u[4] + g_dd_33 * BLphoton_u[7];
+    double k_theta = sigma * BLphoton_u[6];
+
+    EQL[0] = En;
+    EQL[1] = L;
+    EQL[2] = k_theta * k_theta -
+             cost * cost * (a * a * En * En - L * L / (sint * sint));
+
+    y[0] = r;
+    y[1] = sigma * BLphoton_u[5] * rfactor;
+    y[2] = cost;
+    y[3] = -sint * k_theta;
+    y[4] = BLphoton_u[3];
+    y[5] = BLphoton_u[0];
+    y[6] = 0.;
+}
+
+// Mino-time derivatives of the state y of mino_init. r and u obey second
+// order equations, which pass turning points smoothly
+void f_mino(double y[7], double EQL[3], double dy[7]) {
+    double r = y[0], u = y[2];
+    double En = EQL[0], L = EQL[1], Q = EQL[2];
+    double P = En * (r * r + a * a) - a * L;
+    double delta = r * r + a * a - 2. * r;
+    double K = (L - a * En) * (L - a * En) + Q;
+
+    dy[0] = y[1];
+    dy[1] = 2. * En * r * P - (r - 1.) * K;
+    dy[2] = y[3];
+    dy[3] = -(Q + L * L - a * a * En * En) * u -
+            2. * a * a * En * En * u * u * u;
+    dy[4] = a * P / delta - a * En + (L == 0. ? 0. : L / (1. - u * u));
+    dy[5] = (r * r + a * a) * P / delta + a * (L - a * En * (1. - u * u));
+    dy[6] = r * r + a * a * u * u;
+}
+
+// Advances the Mino-time state y by about the affine step dlambda with one
+// RK4 step, then restores dr/dlambda_M and du/dlambda_M from their
+// potentials, so E, L and Q stay exact. photon_u is rebuilt from y, and
+// dlambda is set to the affine step taken
+void mino_step(double photon_u[8], double y[7], double EQL[3],
+               double *dlambda) {
+    double h = *dlambda / (y[0] * y[0] + a * a * y[2] * y[2]);
+    double lambda0 = y[6];
+    double k1[7], k2[7], k3[7], k4[7], yt[7];
+    int i;
+
+    f_mino(y, EQL, k1);
+    for (i = 0; i < 7; i++)
+        yt[i] = y[i] + 0.5 * h * k1[i];
+    f_mino(yt, EQL, k2);
+    for (i = 0; i < 7; i++)
+        yt[i] = y[i] + 0.5 * h * k2[i];
+    f_mino(yt, EQL, k3);
+    for (i = 0; i < 7; i++)
+        yt[i] = y[i] + h * k3[i];
+    f_mino(yt, EQL, k4);
+    for (i = 0; i < 7; i++)
+        y[i] += h / 6. * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+
+    double En = EQL[0], L = EQL[1], Q = EQL[2];
+    double r = y[0], u = fmax(-1., fmin(1., y[2]));
+    double P = En * (r * r + a * a) - a * L;
+    double delta = r * r + a * a - 2. * r;
+    double R = P * P - delta * ((L - a * En) * (L - a * En) + Q);
+    double Theta_u = Q - (Q + L * L - a * a * En * En) * u * u -
+                     a * a * En * En * u * u * u * u;
+    y[1] = copysign(sqrt(fmax(R, 0.)), y[1]);
+    y[3] = copysign(sqrt(fmax(Theta_u, 0.)), y[3]);
+
+    // Wave vector dX/dlambda = (dX/dlambda_M) / Sigma
+    double dy[7];
+    f_mino(y, EQL, dy);
+    double sigma = r * r + a * a * u * u;
+    double sint = sqrt(fmax(1. - u * u, 1e-30));
+    double rfactor = logscale ? r : 1.;
+    double BLphoton_u[8] = {y[5],
+                            logscale ? log(r) : r,
+                            acos(u),
+                            y[4],
+                            dy[5] / sigma,
+                            dy[0] / (sigma * rfactor),
+                            -y[3] / (sint * sigma),
+                            dy[4] / sigma};
+#if (metric == MKSHARM || metric == MKSBHAC)
+    // As BL_to_code_u, but X2 is found by Newton iteration from its previous
+    // value, which a step changes little, and U2 follows directly
+    double X2 = photon_u[2];
+    BL_to_KS_u(BLphoton_u, photon_u);
+    for (i = 0; i < 10; i++) {
+        double dX2 = f_Xg2(X2, BLphoton_u[2]) / f_primed_Xg2(X2);
+        X2 -= dX2;
+        if (fabs(dX2) < 1e-14)
+            break;
+    }
+    photon_u[2] = X2;
+    photon_u[6] /= f_primed_Xg2(X2);
+#else
+    BL_to_code_u(BLphoton_u, photon_u);
+#endif
+
+    *dlambda = y[6] - lambda0;
+}
+
+// Doubles the capacity (in steps) of a lightpath buffer, starting at
+// max_steps
+void grow_lightpath(double **lightpath, int *capacity) {
+    int new_capacity = (*capacity > 0) ? 2 * *capacity : (int)max_steps;
+    double *grown =
+        realloc(*lightpath, 9 * (size_t)new_capacity * sizeof(double));
+    if (grown == NULL) {
+        fprintf(stderr, "Cannot grow lightpath to %d steps\n", new_capacity);
+        exit(1);
+    }
+    *lightpath = grown;
+    *capacity = new_capacity;
+}
+
+// Sets up the null geodesic of the camera ray at alpha, beta in ray, and
+// resets the lightpath buffer, which holds "capacity" steps and grows as
+// needed
+void geodesic_start(double alpha, double beta, struct Ray *ray,
+                    double **lightpath_buffer, int *capacity, int *steps) {
     double t_init = 0.;
-    double dlambda_adaptive = -0.1;
-    int theta_turns = 0;
-    double thetadot_prev;
-    double X_u[4], k_u[4];
-    double photon_u[8];
-    double null_arr[4] = {0.0,0.0,0.0,0.0};
+
+    ray->alpha = alpha;
+    ray->beta = beta;
+    ray->theta_turns = 0;
+    ray->thetadot_prev = 0.;
+    ray->lambda = 0.;
+    ray->terminate = 0;
+    ray->done = 0;
+
     // Create initial ray conditions
-    initialize_photon(alpha, beta, photon_u, t_init);
-    LOOP_i X_u[i] = photon_u[i];
-    LOOP_i k_u[i] = photon_u[i+4];
-    // Current r-coordinate
-    double r_current = get_r(X_u);
+    initialize_photon(alpha, beta, ray->photon_u, t_init);
+    ray->r_outer = cutoff_outer;
 
-    // Reset lambda and steps
-    double lambda = 0.;
+    // Reset steps
     *steps = 0;
+    ray->steps = 0;
+
+    if (*capacity < 1)
+        grow_lightpath(lightpath_buffer, capacity);
+
+#if (FAST_FORWARD)
+    // The ray crosses vacuum until FF_RADIUS, so it is placed there directly.
+    // The camera photon is kept as the first entry, with dlambda = 0, for the
+    // observer frame; rays that miss the sphere end there, and rays that
+    // leave it again are done
+    double *lightpath = *lightpath_buffer;
+    for (int q = 0; q < 8; q++)
+        lightpath[q] = ray->photon_u[q];
+    lightpath[8] = 0.;
+    *steps = 1;
+    ray->steps = 1;
+    if (!initialize_photon_at(alpha, beta, ray->photon_u, t_init, FF_RADIUS,
+                              &ray->theta_turns)) {
+        ray->done = 1;
+        return;
+    }
+    ray->r_outer = 1.01 * FF_RADIUS;
+#endif
 
-    int TERMINATE = 0; // Termination condition for ray
+#if (int_method == MINO)
+    // Mino-time state and constants of motion of the ray
+    mino_init(ray->photon_u, ray->mino_y, ray->EQL);
+#endif
 
-    // Trace light ray until it reaches the event horizon or the outer
-    // cutoff, or steps > max_steps
-#if (metric == BL || metric == MBL)
+#if (int_method == DOPRI5)
+    // The integrator takes steps of its own from dp_lambda_a to dp_lambda_b,
+    // and the lightpath samples, spaced by stepsize(), are read from the
+    // dense output of the step they fall in
+    double X_u[4], k_u[4];
+    LOOP_i {
+        X_u[i] = ray->photon_u[i];
+        k_u[i] = ray->photon_u[i + 4];
+    }
+    ray->dp_h = stepsize(X_u, k_u);
+    ray->dp_err_old = 1.e-4;
+    ray->dp_lambda_a = 0.;
+    ray->dp_lambda_b = 0.;
+    for (int q = 0; q < 8; q++)
+        ray->dp_y[q] = ray->photon_u[q];
+    f_geodesic(ray->dp_y, ray->dp_f);
+    dopri_evals++;
+    lower_index(X_u, k_u, ray->dp_k_d);
+#endif
+}
 
-    // Stop condition for BL coords
-    while (r_current > cutoff_inner && r_current < cutoff_outer &&
-           *steps < max_steps && !TERMINATE) { // && photon_u[0] < t_final){
+// Takes the next step of ray and writes its lightpath entry: the position and
+// wave vector the step starts from, and the size of the step. Returns 0, and
+// sets ray->done, once the ray has reached the event horizon, the outer
+// cutoff or max_steps_hard.
+int geodesic_step(struct Ray *ray, double lightpath_entry[9],
+                  double cutoff_inner) {
+    int q;
+    double dlambda_adaptive;
+    double X_u[4], k_u[4];
+    double *photon_u = ray->photon_u;
 
-#else
+    if (ray->done)
+        return 0;
+
+    // Current photon position/wave vector
+    LOOP_i {
+        X_u[i] = photon_u[i];
+        k_u[i] = photon_u[i + 4];
+    }
+
+    // Current r-coordinate
+    double r_current = get_r(X_u);
 
-    // Stop condition for KS coords
-    while (r_current < cutoff_outer && r_current > cutoff_inner &&
-           *steps < max_steps && !TERMINATE) {
+    // Trace light ray until it reaches the event horizon or the outer
+    // cutoff, or steps > max_steps_hard
+    if (!(r_current < ray->r_outer && r_current > cutoff_inner &&
+          ray->steps < max_steps_hard && !ray->terminate)) {
+        ray->done = 1;
 
+#if (PRINT_GEODESIC)
+        double null_arr[4] = {0.0, 0.0, 0.0, 0.0};
+        if (geo_counter == 2)
+            write_ray_output(null_arr);
 #endif
-        // Current photon position/wave vector
-        LOOP_i {
-            X_u[i] = photon_u[i];
-            k_u[i] = photon_u[i + 4];
-        }
 
-        LOOP_i {
-            photon_u[i+4] = k_u[i];
-        }
+#if (int_method == DOPRI5)
+        // Relative drift of k_t, which is conserved along the ray
+        double k_d[4];
+        lower_index(X_u, k_u, k_d);
+        double drift = fabs(k_d[0] / ray->dp_k_d[0] - 1.);
+        dopri_rays++;
+        dopri_drift_sum += drift;
+        dopri_drift_max = fmax(dopri_drift_max, drift);
+#endif
+        return 0;
+    }
 
-        // Enter current position/velocity/dlambda into lightpath
-        for (q = 0; q < 8; q++)
-            lightpath[*steps * 9 + q] = photon_u[q];
+    // Enter current position/velocity into lightpath
+    for (q = 0; q < 8; q++)
+        lightpath_entry[q] = photon_u[q];
 
-        // Possibly terminate ray to eliminate higher order images
-        if (thetadot_prev * photon_u[6] < 0. && *steps > 2)
-            theta_turns += 1;
-        thetadot_prev = photon_u[6];
-        if ((beta < 0. && theta_turns > max_order) ||
-            (beta > 0. && theta_turns > (max_order + 1)))
-            TERMINATE = 1;
+    // Possibly terminate ray to eliminate higher order images
+    if (ray->thetadot_prev * photon_u[6] < 0. && ray->steps > 2)
+        ray->theta_turns += 1;
+    ray->thetadot_prev = photon_u[6];
+    if ((ray->beta < 0. && ray->theta_turns > max_order) ||
+        (ray->beta > 0. && ray->theta_turns > (max_order + 1)))
+        ray->terminate = 1;
 
-        // Compute educational guess for an adaptive step size
-        // dlambda_adaptive = -STEPSIZE;
-        dlambda_adaptive = stepsize(X_u, k_u);
+    // Compute educational guess for an adaptive step size
+    // dlambda_adaptive = -STEPSIZE;
+    dlambda_adaptive = stepsize(X_u, k_u);
 
 #if (PRINT_GEODESIC)
-	if (geo_counter == 2)
-		write_ray_output(X_u);
+    if (geo_counter == 2)
+        write_ray_output(X_u);
 #endif
 
-        // Advance ray/particle
+    // Advance ray/particle
 #if (int_method == RK2)
 
-        rk2_step(photon_u, &f_geodesic, dlambda_adaptive);
+    rk2_step(photon_u, &f_geodesic, dlambda_adaptive);
 
 #elif (int_method == RK4)
 
-        rk4_step(photon_u, &f_geodesic, dlambda_adaptive);
+    rk4_step(photon_u, &f_geodesic, dlambda_adaptive);
 
 #elif (int_method == VER)
 
@@ -416,25 +766,222 @@ void integrate_geodesic(double alpha, double beta, double *lightpath,
 #elif (int_method == RK45)
 
     rk45_step(photon_u, &f_geodesic, &dlambda_adaptive, 1);
-#endif
 
+#elif (int_method == MINO)
+
+    mino_step(photon_u, ray->mino_y, ray->EQL, &dlambda_adaptive);
 
-        lightpath[*steps * 9 + 8] = fabs(dlambda_adaptive);
+#elif (int_method == DOPRI5)
 
-        LOOP_i X_u[i] = photon_u[i];
-        LOOP_i k_u[i] = photon_u[i + 4];
+    while (ray->dp_lambda_b < ray->lambda + fabs(dlambda_adaptive)) {
+        ray->dp_lambda_a = ray->dp_lambda_b;
+        ray->dp_lambda_b += dopri5_step(ray->dp_y, ray->dp_f, &f_geodesic,
+                                        &ray->dp_h, &ray->dp_err_old,
+                                        ray->dp_rcont);
+    }
+    dopri5_dense(ray->dp_rcont,
+                 (ray->lambda + fabs(dlambda_adaptive) - ray->dp_lambda_a) /
+                     (ray->dp_lambda_b - ray->dp_lambda_a),
+                 photon_u);
+#endif
 
-        // Advance (affine) parameter lambda
-        lambda += fabs(dlambda_adaptive);
-        r_current = get_r(X_u);
+    // Enter dlambda into lightpath
+    lightpath_entry[8] = fabs(dlambda_adaptive);
+
+    // Advance (affine) parameter lambda and count the step
+    ray->lambda += fabs(dlambda_adaptive);
+    ray->steps = ray->steps + 1;
+
+    return 1;
+}
 
+// Continues the geodesic of ray into the lightpath buffer until it ends or
+// the lightpath holds stop_steps steps
+void geodesic_advance(struct Ray *ray, double **lightpath_buffer,
+                      int *capacity, int *steps, int stop_steps,
+                      double cutoff_inner) {
+    while (*steps < stop_steps) {
+        if (*steps >= *capacity)
+            grow_lightpath(lightpath_buffer, capacity);
+        if (!geodesic_step(ray, &(*lightpath_buffer)[*steps * 9],
+                           cutoff_inner))
+            return;
         *steps = *steps + 1;
     }
+}
 
-#if (PRINT_GEODESIC)
-	if (geo_counter == 2)
-		write_ray_output(null_arr);
+// Integrate the null geodesic of the camera ray at alpha, beta into the
+// lightpath buffer, which holds "capacity" steps and grows as needed
+void integrate_geodesic(double alpha, double beta, double **lightpath_buffer,
+                        int *capacity, int *steps, double cutoff_inner) {
+    struct Ray ray;
+    geodesic_start(alpha, beta, &ray, lightpath_buffer, capacity, steps);
+    // The ray ends by itself at max_steps_hard
+    geodesic_advance(&ray, lightpath_buffer, capacity, steps,
+                     max_steps_hard + 1, cutoff_inner);
+}
+
+#if (RAY_PACKET > 1)
+#if (int_method != RK2 && int_method != RK4)
+#error "RAY_PACKET > 1 needs int_method RK2 or RK4"
+#endif
+
+// The function to be used by the packet integrator, as f_geodesic, for rays
+// stored lane by lane as y[i][lane]
+void f_geodesic_packet(double y[DIM * 2][RAY_PACKET],
+                       double fvector[DIM * 2][RAY_PACKET]) {
+    for (int i = 0; i < DIM; i++)
+        for (int lane = 0; lane < RAY_PACKET; lane++)
+            fvector[i][lane] = y[i + DIM][lane];
+
+    // Compute the 4-accelerations of all lanes at once
+    geodesic_accel_packet(y, y + DIM, fvector + DIM);
+}
+
+// Updates a packet of rays by one RK4 (or RK2) step of size dt[lane] per lane,
+// in the same order of operations as rk4_step and rk2_step, so every lane
+// follows its ray exactly as the scalar integrator does. Lanes with dt = 0
+// stay where they are.
+void rk_step_packet(double y[DIM * 2][RAY_PACKET], double dt[RAY_PACKET]) {
+#if (int_method == RK4)
+    int stages = 4;
+    double weights[4] = {0.5, 0.5, 1., 0.};
+#else
+    int stages = 2;
+    double weights[2] = {0.5, 0.};
 #endif
+    double dx[4][DIM * 2][RAY_PACKET];
+    double yshift[DIM * 2][RAY_PACKET], fvector[DIM * 2][RAY_PACKET];
+    int i, q;
+
+    for (i = 0; i < DIM * 2; i++)
+        for (int lane = 0; lane < RAY_PACKET; lane++)
+            yshift[i][lane] = y[i][lane];
 
+    for (q = 0; q < stages; q++) {
+        f_geodesic_packet(yshift, fvector);
+        for (i = 0; i < DIM * 2; i++) {
+#pragma omp simd
+            for (int lane = 0; lane < RAY_PACKET; lane++) {
+                dx[q][i][lane] = dt[lane] * fvector[i][lane];
+                yshift[i][lane] = y[i][lane] + dx[q][i][lane] * weights[q];
+            }
+        }
+    }
 
+    for (i = 0; i < DIM * 2; i++) {
+#pragma omp simd
+        for (int lane = 0; lane < RAY_PACKET; lane++) {
+#if (int_method == RK4)
+            y[i][lane] =
+                y[i][lane] + 1. / 6. *
+                                 (dx[0][i][lane] + dx[1][i][lane] * 2. +
+                                  dx[2][i][lane] * 2. + dx[3][i][lane]);
+#else
+            y[i][lane] = y[i][lane] + dx[1][i][lane];
+#endif
+        }
+    }
 }
+
+// Integrates the null geodesics of RAY_PACKET camera rays in lockstep, one
+// lightpath per lane as integrate_geodesic would give it. Every lane takes
+// its own stepsize(); lanes that are not active or have terminated take zero
+// steps until the whole packet is done.
+void integrate_geodesic_packet(double alpha[RAY_PACKET],
+                               double beta[RAY_PACKET],
+                               int active[RAY_PACKET],
+                               double *lightpath_buffer[RAY_PACKET],
+                               int capacity[RAY_PACKET],
+                               int steps[RAY_PACKET], double cutoff_inner) {
+    double t_init = 0.;
+    double y[DIM * 2][RAY_PACKET], dlambda[RAY_PACKET];
+    double r_outer[RAY_PACKET], thetadot_prev[RAY_PACKET];
+    int theta_turns[RAY_PACKET], tracing[RAY_PACKET];
+    int n_tracing = 0;
+
+    for (int lane = 0; lane < RAY_PACKET; lane++) {
+        double photon_u[8];
+        int q;
+
+        // Create initial ray conditions; lanes that are not traced keep a
+        // valid photon so the packet can be evaluated as a whole
+        initialize_photon(alpha[lane], beta[lane], photon_u, t_init);
+        r_outer[lane] = cutoff_outer;
+        theta_turns[lane] = 0;
+        thetadot_prev[lane] = 0.;
+        steps[lane] = 0;
+        tracing[lane] = active[lane];
+
+        if (active[lane]) {
+            if (capacity[lane] < 1)
+                grow_lightpath(&lightpath_buffer[lane], &capacity[lane]);
+#if (FAST_FORWARD)
+            // As in integrate_geodesic, the camera photon is the first entry
+            double *lightpath = lightpath_buffer[lane];
+            for (q = 0; q < 8; q++)
+                lightpath[q] = photon_u[q];
+            lightpath[8] = 0.;
+            steps[lane] = 1;
+            if (!initialize_photon_at(alpha[lane], beta[lane], photon_u,
+                                      t_init, FF_RADIUS, &theta_turns[lane]))
+                tracing[lane] = 0;
+            r_outer[lane] = 1.01 * FF_RADIUS;
+#endif
+        }
+
+        for (q = 0; q < 8; q++)
+            y[q][lane] = photon_u[q];
+        n_tracing += tracing[lane];
+    }
+
+    while (n_tracing > 0) {
+        for (int lane = 0; lane < RAY_PACKET; lane++) {
+            dlambda[lane] = 0.;
+            if (!tracing[lane])
+                continue;
+
+            double X_u[4], k_u[4];
+            LOOP_i {
+                X_u[i] = y[i][lane];
+                k_u[i] = y[i + 4][lane];
+            }
+
+            // Stop condition of integrate_geodesic
+            double r_current = get_r(X_u);
+            if (!(r_current < r_outer[lane] && r_current > cutoff_inner &&
+                  steps[lane] < max_steps_hard)) {
+                tracing[lane] = 0;
+                n_tracing--;
+                continue;
+            }
+
+            if (steps[lane] >= capacity[lane])
+                grow_lightpath(&lightpath_buffer[lane], &capacity[lane]);
+
+            // Enter current position/velocity into lightpath
+            double *lightpath = lightpath_buffer[lane];
+            for (int q = 0; q < 8; q++)
+                lightpath[steps[lane] * 9 + q] = y[q][lane];
+
+            // Possibly terminate ray to eliminate higher order images; the
+            // lane still takes this step, as the scalar integrator does
+            if (thetadot_prev[lane] * y[6][lane] < 0. && steps[lane] > 2)
+                theta_turns[lane] += 1;
+            thetadot_prev[lane] = y[6][lane];
+            if ((beta[lane] < 0. && theta_turns[lane] > max_order) ||
+                (beta[lane] > 0. && theta_turns[lane] > (max_order + 1))) {
+                tracing[lane] = 0;
+                n_tracing--;
+            }
+
+            dlambda[lane] = stepsize(X_u, k_u);
+            lightpath[steps[lane] * 9 + 8] = fabs(dlambda[lane]);
+            steps[lane] = steps[lane] + 1;
+        }
+
+        // Advance all lanes; those that stopped above have dlambda = 0
+        rk_step_packet(y, dlambda);
+    }
+}
+#endif
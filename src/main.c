@@ -89,6 +89,15 @@ int main(int argc, char *argv[]) {
     // These depend on the black hole spin
     set_constants();
 
+#if (DEBUG && metric == CKS)
+    check_connection();
+#endif
+
+#if (EMIS_TABLE)
+    // Tabulate the kappa/power-law coefficients, or load them from disk
+    init_emission_tables();
+#endif
+
 #if ((BREMSSTRAHLUNG && DF == KAPPA) || (BREMSSTRAHLUNG && DF == POWER))
     fprintf(stderr, "ERROR: Bremsstrahlung not compatible with chosen EDF, switching to synchrotron only... \n");
     #define BREMSSTRAHLUNG (0);
@@ -136,31 +145,31 @@ int main(int argc, char *argv[]) {
     prerun_refine(&intensityfield);
 #endif
 
+#if (GEO_CACHE)
+    geo_cache_init();
+#endif
+
     rayfile = fopen("output/ray_data.dat","w");
     geo_counter = 0;
     
-    int block = 0;
-
-    while (block  < tot_blocks) { // block_total
-        if (block % (25) == 0)
-            fprintf(stderr, "block %d of total %d\n", block, tot_blocks);
-
-        calculate_image_block(&intensityfield[block], frequencies);
 #if (AMR)
-        if (refine_block(intensityfield[block])) {
-            add_block(&intensityfield, block);
-        } else {
-            block++;
-        }
+    // Trace and refine the camera one level at a time
+    refine_camera(&intensityfield, frequencies);
 #else
-        block++;
+    // All blocks are known up front, trace them as a single pool of pixels
+    calculate_image_blocks(intensityfield, tot_blocks, frequencies);
 #endif
-    }
 
     fclose(rayfile);
 
+#if (GEO_CACHE)
+    geo_cache_close();
+#endif
+
     fprintf(stderr, "\nRay tracing done!\n\n");
 
+    report_image_steps();
+
     compute_spec(intensityfield, energy_spectrum);
 
 #if (USERSPEC)
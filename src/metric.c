@@ -192,7 +192,7 @@ void metric_dd(double X_u[4], double g_dd[4][4]) {
     l[0] = 1;
     l[1] = (r * X_u[1] + a * X_u[2]) * idel;
     l[2] = (r * X_u[2] - a * X_u[1]) * idel;
-    l[3] = (X_u[3]) / (r + 1e-3);
+    l[3] = (r < 1) ? X_u[3] / (r + 1e-3) : X_u[3] / r;
 
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
@@ -381,7 +381,7 @@ void metric_uu(double X_u[4], double g_uu[4][4]) {
     l[0] = -1.;
     l[1] = (r * X_u[1] + a * X_u[2]) * idel;
     l[2] = (r * X_u[2] - a * X_u[1]) * idel;
-    l[3] = (X_u[3]) / (r);
+    l[3] = (r < 1) ? X_u[3] / (r + 1e-3) : X_u[3] / r;
 
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
@@ -459,12 +459,9 @@ void connection_num_udd(double X_u[4], double gamma_udd[4][4][4]) {
         }
 
 #if (metric == CKS)
-        double r = get_r(X_u);
-        double fac;
-        if (fabs(X_u[i]) > delta_num * 1e-2)
-            fac = fabs(X_u[i]);
-        else
-            fac = delta_num * 1e-2;
+        // Relative steps, but at least delta_num: smaller steps near the
+        // coordinate planes (and in t = 0) are lost in round-off
+        double fac = fmax(fabs(X_u[i]), 1.);
 #else
         double fac = 1.0;
 #endif
@@ -1114,6 +1111,72 @@ void connection_udd(double X_u[4], double gamma[4][4][4]) {
     gamma[3][3][3] = -a * C * sin2th;
 
     // Symmetries
+#elif (metric == CKS) // Cartesian Kerr-Schild metric
+
+    // g_dd = eta + f l l, the derivatives of f and l follow from
+    // r^4 - (R^2 - a^2) r^2 - a^2 z^2 = 0. Time derivatives vanish. For r < 1
+    // f and l_z are regularised as in metric_dd.
+    double x = X_u[1];
+    double y = X_u[2];
+    double z = X_u[3];
+    double R2 = x * x + y * y + z * z;
+    double a2 = a * a;
+    double r2 = (R2 - a2 + sqrt((R2 - a2) * (R2 - a2) + 4. * a2 * z * z)) * 0.5;
+    double r = sqrt(r2);
+
+    double sig = r2 * r2 + a2 * z * z;
+    double isig = (r < 1) ? 1. / (sig + 1e-3) : 1. / sig;
+    double rl = (r < 1) ? r + 1e-3 : r;
+    double idel = 1. / (r2 + a2);
+
+    double f = 2. * r2 * r * isig;
+    double l[4];
+    l[0] = 1.;
+    l[1] = (r * x + a * y) * idel;
+    l[2] = (r * y - a * x) * idel;
+    l[3] = z / rl;
+
+    double dr[4], df[4], dl[4][4];
+    dr[0] = 0.;
+    dr[1] = r2 * r * x / sig;
+    dr[2] = r2 * r * y / sig;
+    dr[3] = r * z * (r2 + a2) / sig;
+
+    LOOP_i {
+        double dsig = 4. * r2 * r * dr[i] + (i == 3 ? 2. * a2 * z : 0.);
+        df[i] = (6. * r2 * dr[i] - f * dsig) * isig;
+
+        dl[i][0] = 0.;
+        dl[i][1] = (dr[i] * x + (i == 1 ? r : 0.) + (i == 2 ? a : 0.) -
+                    2. * r * dr[i] * l[1]) *
+                   idel;
+        dl[i][2] = (dr[i] * y + (i == 2 ? r : 0.) - (i == 1 ? a : 0.) -
+                    2. * r * dr[i] * l[2]) *
+                   idel;
+        dl[i][3] = ((i == 3 ? 1. : 0.) - l[3] * dr[i]) / rl;
+    }
+
+    // dg[i][j][k] = d_i g_jk
+    double dg[4][4][4];
+    LOOP_ijk dg[i][j][k] =
+        df[i] * l[j] * l[k] + f * (dl[i][j] * l[k] + l[j] * dl[i][k]);
+
+    double g_uu[4][4];
+    metric_uu(X_u, g_uu);
+
+    LOOP_ijk {
+        gamma[i][j][k] = 0.;
+        if (k < j)
+            continue;
+        for (int d = 0; d < 4; d++)
+            gamma[i][j][k] +=
+                0.5 * g_uu[i][d] * (dg[j][d][k] + dg[k][d][j] - dg[d][j][k]);
+    }
+    LOOP_ijk {
+        if (k < j)
+            gamma[i][j][k] = gamma[i][k][j];
+    }
+
 #else
     fprintf(stderr,
             "Analytical connections not avaialbe for this metric in metric.c, "
@@ -1122,6 +1185,473 @@ void connection_udd(double X_u[4], double gamma[4][4][4]) {
 #endif
 }
 
+#if (metric == CKS)
+// Compares connection_udd with connection_num_udd on a fixed set of points
+// with r >= 1.5, away from the regularised region r < 1, and stops if they
+// disagree by more than 1e-6 relative to the largest symbol
+void check_connection() {
+    double radii[5] = {1.5, 2., 4., 10., 50.};
+    double thetas[4] = {0.3, 1., M_PI / 2., 2.4};
+    double phis[3] = {0., 1.3, 4.};
+    double err_max = 0.;
+
+    for (int ir = 0; ir < 5; ir++)
+        for (int ith = 0; ith < 4; ith++)
+            for (int iph = 0; iph < 3; iph++) {
+                double r = radii[ir], rho = sqrt(r * r + a * a);
+                double X_u[4] = {0., rho * sin(thetas[ith]) * cos(phis[iph]),
+                                 rho * sin(thetas[ith]) * sin(phis[iph]),
+                                 r * cos(thetas[ith])};
+                double gamma[4][4][4], gamma_num[4][4][4];
+                connection_udd(X_u, gamma);
+                connection_num_udd(X_u, gamma_num);
+
+                double diff = 0., norm = 0.;
+                LOOP_ijk {
+                    diff = fmax(diff, fabs(gamma[i][j][k] - gamma_num[i][j][k]));
+                    norm = fmax(norm, fabs(gamma[i][j][k]));
+                }
+                err_max = fmax(err_max, diff / norm);
+            }
+
+    fprintf(stderr, "CKS connection: analytic vs numerical %e\n", err_max);
+    if (err_max > 1e-6) {
+        fprintf(stderr, "ERROR: analytic CKS connection is inconsistent with "
+                        "the metric\n");
+        exit(1);
+    }
+}
+#endif
+
+// The Kerr kernels below work on packets of rays stored lane by lane
+// (X_u[i][lane]) and evaluate the first "lanes" lanes. Their lane loops are
+// written for the compiler to vectorize; single rays use lane 0.
+
+#if (metric == MKSHARM || metric == MKSBHAC || metric == KS)
+// Index of the component jk in the symmetric storage G[i][10] of the
+// connection
+static const int sym[4][4] = {
+    {0, 1, 2, 3}, {1, 4, 5, 6}, {2, 5, 7, 8}, {3, 6, 8, 9}};
+
+// Coordinate factors of the Kerr connection in (modified) KS coordinates:
+// fac = {r, dr/dX1, d2r/dX1^2, sin(theta), cos(theta), dtheta/dX2,
+// d2theta/dX2^2}. These hold all transcendental functions of the connection
+static void mks_factors(int lanes, double X_u[4][RAY_PACKET],
+                        double fac[7][RAY_PACKET]) {
+#pragma omp simd
+    for (int lane = 0; lane < lanes; lane++) {
+        double X1 = X_u[1][lane];
+        double X2 = X_u[2][lane];
+        double rprime = logscale ? exp(X1) : 1.;
+        double r = logscale ? exp(X1) + R0 : X1;
+#if (metric == MKSHARM)
+        double theta = M_PI * X2 + 0.5 * (1. - hslope) * sin(2. * M_PI * X2);
+        double thetaprime = M_PI * (1. + (1. - hslope) * cos(2. * M_PI * X2));
+        double thetaprimeprime =
+            -2. * M_PI * M_PI * (1. - hslope) * sin(2. * M_PI * X2);
+#elif (metric == MKSBHAC)
+        double theta = X2 + 0.5 * hslope * sin(2. * X2);
+        double thetaprime = (1. + hslope * cos(2. * X2));
+        double thetaprimeprime = -2. * hslope * sin(2. * X2);
+#else
+        double theta = X2;
+        double thetaprime = 1.;
+        double thetaprimeprime = 0.;
+#endif
+        fac[0][lane] = r;
+        fac[1][lane] = rprime;
+        fac[2][lane] = logscale ? rprime : 0.;
+        fac[3][lane] = sin(theta);
+        fac[4][lane] = cos(theta);
+        fac[5][lane] = thetaprime;
+        fac[6][lane] = thetaprimeprime;
+    }
+}
+
+// Fills the independent components G[i][sym[j][k]] = Gamma^i_jk of the Kerr
+// connection in (modified) KS coordinates from the factors of mks_factors();
+// Gamma^r and Gamma^theta_{t theta}, _{theta phi} vanish
+static void mks_connection(int lanes, double fac[7][RAY_PACKET],
+                           double G[4][10][RAY_PACKET]) {
+#pragma omp simd
+    for (int lane = 0; lane < lanes; lane++) {
+        double r = fac[0][lane];
+        double r2 = r * r;
+        double rprime = fac[1][lane];
+        double rprime2 = rprime * rprime;
+        double rprimeprime = fac[2][lane];
+        double sinth = fac[3][lane];
+        double costh = fac[4][lane];
+        double thetaprime = fac[5][lane];
+        double thetaprime2 = thetaprime * thetaprime;
+        double thetaprimeprime = fac[6][lane];
+
+        double sin2th = sinth * sinth;
+        double sintwoth = 2. * sinth * costh;
+        double cotth = costh / sinth;
+        double a2 = a * a;
+
+        double Sigma = r2 + a2 * costh * costh;
+        double Delta = r2 - 2. * r + a2;
+        double A = Sigma * Delta + 2. * r * (r2 + a2);
+        double Sigmabar = 1. / Sigma;
+        double Sigmabar2 = Sigmabar * Sigmabar;
+        double Sigmabar3 = Sigmabar2 * Sigmabar;
+        double B = (2. * r2 - Sigma) * Sigmabar3;
+        double C = r * Sigmabar - a2 * B * sin2th;
+
+        // Gamma[t][mu][nu]
+        double G001 = (Sigma + 2. * r) * B * rprime;
+        double G002 = -a2 * r * sintwoth * Sigmabar2 * thetaprime;
+        G[0][0][lane] = 2. * r * B;
+        G[0][1][lane] = G001;
+        G[0][2][lane] = G002;
+        G[0][3][lane] = -2. * a * r * B * sin2th;
+        G[0][4][lane] = 2. * (Sigma + r) * B * rprime2;
+        G[0][5][lane] = G002 * rprime;
+        G[0][6][lane] = -a * sin2th * G001;
+        G[0][7][lane] = -2. * r2 * Sigmabar * thetaprime2;
+        G[0][8][lane] = -a * sin2th * G002;
+        G[0][9][lane] = -2. * r * C * sin2th;
+
+        // Gamma[r][mu][nu]
+        double G100 = Delta * B / rprime;
+        double G112 = -a2 * sinth * costh * Sigmabar * thetaprime;
+        G[1][0][lane] = G100;
+        G[1][1][lane] = (Delta - Sigma) * B;
+        G[1][2][lane] = 0.;
+        G[1][3][lane] = -a * sin2th * G100;
+        G[1][4][lane] =
+            rprimeprime / rprime - (2. * Sigma - Delta) * B * rprime;
+        G[1][5][lane] = G112;
+        G[1][6][lane] = a * (r * Sigmabar + (Sigma - Delta) * B) * sin2th;
+        G[1][7][lane] = -r * Delta * Sigmabar / rprime * thetaprime2;
+        G[1][8][lane] = 0.;
+        G[1][9][lane] = -Delta * C * sin2th / rprime;
+
+        // Gamma[theta][mu][nu]
+        double G200 = Sigmabar * G002 / thetaprime2;
+        G[2][0][lane] = G200;
+        G[2][1][lane] = G200 * rprime;
+        G[2][2][lane] = 0.;
+        G[2][3][lane] =
+            a * r * (r2 + a2) * sintwoth * Sigmabar3 / thetaprime;
+        G[2][4][lane] = G200 * rprime2;
+        G[2][5][lane] = r * Sigmabar * rprime;
+        G[2][6][lane] = a * sinth * costh * (A + Sigma * (Sigma - Delta)) *
+                        Sigmabar3 * rprime / thetaprime;
+        G[2][7][lane] = thetaprimeprime / thetaprime + G112;
+        G[2][8][lane] = 0.;
+        G[2][9][lane] =
+            -sinth * costh *
+            (Delta * Sigma * Sigma + 2. * r * (r2 + a2) * (r2 + a2)) *
+            Sigmabar3 / thetaprime;
+
+        // Gamma[phi][mu][nu]
+        G[3][0][lane] = a * B;
+        G[3][1][lane] = a * B * rprime;
+        G[3][2][lane] = -2. * a * r * cotth * Sigmabar2 * thetaprime;
+        G[3][3][lane] = -a2 * B * sin2th;
+        G[3][4][lane] = a * B * rprime2;
+        G[3][5][lane] =
+            -a * (Sigma + 2. * r) * cotth * Sigmabar2 * rprime * thetaprime;
+        G[3][6][lane] = C * rprime;
+        G[3][7][lane] = -a * r * Sigmabar * thetaprime2;
+        G[3][8][lane] = (cotth + a2 * r * sintwoth * Sigmabar2) * thetaprime;
+        G[3][9][lane] = -a * C * sin2th;
+    }
+}
+
+// Contracts the connection in symmetric storage twice with U_u; the
+// off-diagonal terms count twice
+static void mks_contract(int lanes, double G[4][10][RAY_PACKET],
+                         double U_u[4][RAY_PACKET],
+                         double A_u[4][RAY_PACKET]) {
+#pragma omp simd
+    for (int lane = 0; lane < lanes; lane++) {
+        double u0 = U_u[0][lane], u1 = U_u[1][lane];
+        double u2 = U_u[2][lane], u3 = U_u[3][lane];
+        double UU00 = u0 * u0, UU01 = 2. * u0 * u1, UU02 = 2. * u0 * u2;
+        double UU03 = 2. * u0 * u3, UU11 = u1 * u1, UU12 = 2. * u1 * u2;
+        double UU13 = 2. * u1 * u3, UU22 = u2 * u2, UU23 = 2. * u2 * u3;
+        double UU33 = u3 * u3;
+
+        A_u[0][lane] =
+            -(G[0][0][lane] * UU00 + G[0][1][lane] * UU01 +
+              G[0][2][lane] * UU02 + G[0][3][lane] * UU03 +
+              G[0][4][lane] * UU11 + G[0][5][lane] * UU12 +
+              G[0][6][lane] * UU13 + G[0][7][lane] * UU22 +
+              G[0][8][lane] * UU23 + G[0][9][lane] * UU33);
+        A_u[1][lane] =
+            -(G[1][0][lane] * UU00 + G[1][1][lane] * UU01 +
+              G[1][3][lane] * UU03 + G[1][4][lane] * UU11 +
+              G[1][5][lane] * UU12 + G[1][6][lane] * UU13 +
+              G[1][7][lane] * UU22 + G[1][9][lane] * UU33);
+        A_u[2][lane] =
+            -(G[2][0][lane] * UU00 + G[2][1][lane] * UU01 +
+              G[2][3][lane] * UU03 + G[2][4][lane] * UU11 +
+              G[2][5][lane] * UU12 + G[2][6][lane] * UU13 +
+              G[2][7][lane] * UU22 + G[2][9][lane] * UU33);
+        A_u[3][lane] =
+            -(G[3][0][lane] * UU00 + G[3][1][lane] * UU01 +
+              G[3][2][lane] * UU02 + G[3][3][lane] * UU03 +
+              G[3][4][lane] * UU11 + G[3][5][lane] * UU12 +
+              G[3][6][lane] * UU13 + G[3][7][lane] * UU22 +
+              G[3][8][lane] * UU23 + G[3][9][lane] * UU33);
+    }
+}
+
+#elif (metric == CKS)
+// Kerr-Schild form g_dd = eta + f l l of the CKS metric, with the spatial
+// derivatives df[i] = d_i f and dl[i][j] = d_i l_j, as in connection_udd;
+// l_0 = 1 and time derivatives vanish
+static void cks_null_form(int lanes, double X_u[4][RAY_PACKET],
+                          double f[RAY_PACKET], double l[4][RAY_PACKET],
+                          double df[4][RAY_PACKET],
+                          double dl[4][4][RAY_PACKET]) {
+#pragma omp simd
+    for (int lane = 0; lane < lanes; lane++) {
+        double x = X_u[1][lane];
+        double y = X_u[2][lane];
+        double z = X_u[3][lane];
+        double R2 = x * x + y * y + z * z;
+        double a2 = a * a;
+        double r2 =
+            (R2 - a2 + sqrt((R2 - a2) * (R2 - a2) + 4. * a2 * z * z)) * 0.5;
+        double r = sqrt(r2);
+
+        double sig = r2 * r2 + a2 * z * z;
+        double isig = (r < 1) ? 1. / (sig + 1e-3) : 1. / sig;
+        double rl = (r < 1) ? r + 1e-3 : r;
+        double idel = 1. / (r2 + a2);
+
+        double fl = 2. * r2 * r * isig;
+        double l1 = (r * x + a * y) * idel;
+        double l2 = (r * y - a * x) * idel;
+        double l3 = z / rl;
+        f[lane] = fl;
+        l[0][lane] = 1.;
+        l[1][lane] = l1;
+        l[2][lane] = l2;
+        l[3][lane] = l3;
+
+        double dr1 = r2 * r * x / sig;
+        double dr2 = r2 * r * y / sig;
+        double dr3 = r * z * (r2 + a2) / sig;
+        df[0][lane] = 0.;
+        df[1][lane] = (6. * r2 * dr1 - fl * 4. * r2 * r * dr1) * isig;
+        df[2][lane] = (6. * r2 * dr2 - fl * 4. * r2 * r * dr2) * isig;
+        df[3][lane] =
+            (6. * r2 * dr3 - fl * (4. * r2 * r * dr3 + 2. * a2 * z)) * isig;
+
+        dl[1][1][lane] = (dr1 * x + r - 2. * r * dr1 * l1) * idel;
+        dl[1][2][lane] = (dr1 * y - a - 2. * r * dr1 * l2) * idel;
+        dl[1][3][lane] = -l3 * dr1 / rl;
+        dl[2][1][lane] = (dr2 * x + a - 2. * r * dr2 * l1) * idel;
+        dl[2][2][lane] = (dr2 * y + r - 2. * r * dr2 * l2) * idel;
+        dl[2][3][lane] = -l3 * dr2 / rl;
+        dl[3][1][lane] = (dr3 * x - 2. * r * dr3 * l1) * idel;
+        dl[3][2][lane] = (dr3 * y - 2. * r * dr3 * l2) * idel;
+        dl[3][3][lane] = (1. - l3 * dr3) / rl;
+    }
+}
+
+// Geodesic acceleration in CKS from the Kerr-Schild form, using
+// Gamma_dij U^i U^j = U^j d_j g_dk U^k - d_d (g_jk U^j U^k) / 2 and
+// g^id = eta^id - f l^i l^d
+static void cks_accel(int lanes, double X_u[4][RAY_PACKET],
+                      double U_u[4][RAY_PACKET], double A_u[4][RAY_PACKET]) {
+    double f[RAY_PACKET], l[4][RAY_PACKET], df[4][RAY_PACKET];
+    double dl[4][4][RAY_PACKET];
+    cks_null_form(lanes, X_u, f, l, df, dl);
+
+#pragma omp simd
+    for (int lane = 0; lane < lanes; lane++) {
+        double u0 = U_u[0][lane], u1 = U_u[1][lane];
+        double u2 = U_u[2][lane], u3 = U_u[3][lane];
+        double fl = f[lane];
+        double l1 = l[1][lane], l2 = l[2][lane], l3 = l[3][lane];
+
+        // l.U, U.df, Udl_k = U^j d_j l_k and dlU_k = d_k l_j U^j
+        double lU = u0 + l1 * u1 + l2 * u2 + l3 * u3;
+        double Udf = u1 * df[1][lane] + u2 * df[2][lane] + u3 * df[3][lane];
+        double Udl1 =
+            u1 * dl[1][1][lane] + u2 * dl[2][1][lane] + u3 * dl[3][1][lane];
+        double Udl2 =
+            u1 * dl[1][2][lane] + u2 * dl[2][2][lane] + u3 * dl[3][2][lane];
+        double Udl3 =
+            u1 * dl[1][3][lane] + u2 * dl[2][3][lane] + u3 * dl[3][3][lane];
+        double dlU1 =
+            dl[1][1][lane] * u1 + dl[1][2][lane] * u2 + dl[1][3][lane] * u3;
+        double dlU2 =
+            dl[2][1][lane] * u1 + dl[2][2][lane] * u2 + dl[2][3][lane] * u3;
+        double dlU3 =
+            dl[3][1][lane] * u1 + dl[3][2][lane] * u2 + dl[3][3][lane] * u3;
+        double UdlU = Udl1 * u1 + Udl2 * u2 + Udl3 * u3;
+
+        // Gamma_dij U^i U^j
+        double G0 = Udf * lU + fl * UdlU;
+        double G1 = Udf * l1 * lU + fl * (Udl1 * lU + l1 * UdlU) -
+                    0.5 * df[1][lane] * lU * lU - fl * lU * dlU1;
+        double G2 = Udf * l2 * lU + fl * (Udl2 * lU + l2 * UdlU) -
+                    0.5 * df[2][lane] * lU * lU - fl * lU * dlU2;
+        double G3 = Udf * l3 * lU + fl * (Udl3 * lU + l3 * UdlU) -
+                    0.5 * df[3][lane] * lU * lU - fl * lU * dlU3;
+
+        // Raised with l^i = eta^ij l_j, so l^0 = -1
+        double lG = -G0 + l1 * G1 + l2 * G2 + l3 * G3;
+        A_u[0][lane] = G0 - fl * lG;
+        A_u[1][lane] = -(G1 - fl * l1 * lG);
+        A_u[2][lane] = -(G2 - fl * l2 * lG);
+        A_u[3][lane] = -(G3 - fl * l3 * lG);
+    }
+}
+#endif
+
+// Returns the geodesic acceleration A_u = -Gamma^i_jk U^j U^k at X_u and,
+// if A_f is not NULL, the matrix A_f[i][k] = -Gamma^i_jk U^j that parallel
+// transports a vector along U_u. For the Kerr metrics the connection is
+// contracted as it is built: MKS and KS keep only the 36 independent nonzero
+// components, and CKS contracts the derivatives of g = eta + f l l directly.
+void geodesic_accel(double X_u[4], double U_u[4], double A_u[4],
+                    double A_f[4][4]) {
+#if (metric == MKSHARM || metric == MKSBHAC || metric == KS || metric == CKS)
+
+    // The ray as lane 0 of a packet
+    double X_p[4][RAY_PACKET], U_p[4][RAY_PACKET], A_p[4][RAY_PACKET];
+    LOOP_i {
+        X_p[i][0] = X_u[i];
+        U_p[i][0] = U_u[i];
+    }
+
+#endif
+#if (metric == MKSHARM || metric == MKSBHAC || metric == KS)
+
+    double fac[7][RAY_PACKET], G[4][10][RAY_PACKET];
+    mks_factors(1, X_p, fac);
+    mks_connection(1, fac, G);
+
+    if (A_f == NULL) {
+        mks_contract(1, G, U_p, A_p);
+        LOOP_i A_u[i] = A_p[i][0];
+        return;
+    }
+
+    LOOP_i {
+        A_u[i] = 0.;
+        for (int k = 0; k < 4; k++) {
+            A_f[i][k] = -(G[i][sym[0][k]][0] * U_u[0] +
+                          G[i][sym[1][k]][0] * U_u[1] +
+                          G[i][sym[2][k]][0] * U_u[2] +
+                          G[i][sym[3][k]][0] * U_u[3]);
+            A_u[i] += A_f[i][k] * U_u[k];
+        }
+    }
+
+#elif (metric == CKS)
+
+    if (A_f == NULL) {
+        cks_accel(1, X_p, U_p, A_p);
+        LOOP_i A_u[i] = A_p[i][0];
+        return;
+    }
+
+    // M[d][k] = Gamma_djk U^j from
+    // U^j d_j g_dk = (U.df) l_d l_k + f ((U.dl)_d l_k + l_d (U.dl)_k) and
+    // U^j d_k g_dj = df_k l_d (l.U) + f (dl_kd (l.U) + l_d (dl.U)_k)
+    double f_p[RAY_PACKET], l_p[4][RAY_PACKET], df_p[4][RAY_PACKET];
+    double dl_p[4][4][RAY_PACKET];
+    cks_null_form(1, X_p, f_p, l_p, df_p, dl_p);
+
+    double f = f_p[0], l[4], df[4], dl[4][4];
+    LOOP_i {
+        l[i] = l_p[i][0];
+        df[i] = df_p[i][0];
+        for (int j = 0; j < 4; j++)
+            dl[i][j] = (i == 0 || j == 0) ? 0. : dl_p[i][j][0];
+    }
+
+    double lU = 0., Udf = 0., Udl[4], dlU[4];
+    LOOP_i {
+        lU += l[i] * U_u[i];
+        Udf += U_u[i] * df[i];
+        Udl[i] = 0.;
+        dlU[i] = 0.;
+        for (int j = 0; j < 4; j++) {
+            Udl[i] += U_u[j] * dl[j][i];
+            dlU[i] += dl[i][j] * U_u[j];
+        }
+    }
+
+    // Contravariant l, raised with eta
+    double l_u[4] = {-l[0], l[1], l[2], l[3]};
+
+    double M[4][4], lM[4];
+    LOOP_ij {
+        double P = Udf * l[i] * l[j] + f * (Udl[i] * l[j] + l[i] * Udl[j]);
+        double Q = df[j] * l[i] * lU + f * (dl[j][i] * lU + l[i] * dlU[j]);
+        double Qt = df[i] * l[j] * lU + f * (dl[i][j] * lU + l[j] * dlU[i]);
+        M[i][j] = 0.5 * (P + Q - Qt);
+    }
+    LOOP_i {
+        lM[i] = 0.;
+        for (int d = 0; d < 4; d++)
+            lM[i] += l_u[d] * M[d][i];
+    }
+    LOOP_i {
+        A_u[i] = 0.;
+        for (int k = 0; k < 4; k++) {
+            A_f[i][k] = -((i == 0 ? -1. : 1.) * M[i][k] - f * l_u[i] * lM[k]);
+            A_u[i] += A_f[i][k] * U_u[k];
+        }
+    }
+
+#else
+
+    double gamma_udd[4][4][4];
+    connection_num_udd(X_u, gamma_udd);
+    LOOP_i A_u[i] = 0.;
+    LOOP_ijk A_u[i] -= gamma_udd[i][j][k] * U_u[j] * U_u[k];
+    if (A_f != NULL) {
+        LOOP_ij A_f[i][j] = 0.;
+        LOOP_ijk A_f[i][k] -= gamma_udd[i][j][k] * U_u[j];
+    }
+
+#endif
+}
+
+// Geodesic accelerations of a packet of RAY_PACKET rays, stored lane by lane
+// (X_u[i][lane]). For MKS only the transcendental factors are evaluated lane
+// by lane unless the math library provides vector versions.
+void geodesic_accel_packet(double X_u[4][RAY_PACKET],
+                           double U_u[4][RAY_PACKET],
+                           double A_u[4][RAY_PACKET]) {
+#if (metric == MKSHARM || metric == MKSBHAC || metric == KS)
+
+    double fac[7][RAY_PACKET], G[4][10][RAY_PACKET];
+    mks_factors(RAY_PACKET, X_u, fac);
+    mks_connection(RAY_PACKET, fac, G);
+    mks_contract(RAY_PACKET, G, U_u, A_u);
+
+#elif (metric == CKS)
+
+    cks_accel(RAY_PACKET, X_u, U_u, A_u);
+
+#else
+
+    for (int lane = 0; lane < RAY_PACKET; lane++) {
+        double X[4], U[4], A[4];
+        LOOP_i {
+            X[i] = X_u[i][lane];
+            U[i] = U_u[i][lane];
+        }
+        geodesic_accel(X, U, A, NULL);
+        LOOP_i A_u[i][lane] = A[i];
+    }
+
+#endif
+}
+
 // Initialize a contravariant photon wave vector based on impact parameters
 // alpha and beta
 // Ref. Cunningham & Bardeen 1973
@@ -1132,14 +1662,14 @@ void initialize_photon(double alpha, double beta, double photon_u[8],
                        double t_init) {
 
     double mu0 = cos(INCLINATION / 180. * M_PI);
-    double Xcam_u[4] = {t_init, logscale ? log(rcam) : rcam, acos(mu0), 0};
+    double Xcam_u[4] = {t_init, rcam, acos(mu0), 0};
     double En = 1.;
     double E2 = En * En;
     double ll = -alpha * sqrt(1. - mu0 * mu0);
     double qq = beta * beta + mu0 * mu0 * (alpha * alpha - 1.);
     double L1 = ll * En;
     double Q1 = qq * E2;
-    double k_d[4], k_u[4];
+    double k_d[4];
     double sinc2 = sin(Xcam_u[2]) * sin(Xcam_u[2]);
     double cosc2 = cos(Xcam_u[2]) * cos(Xcam_u[2]);
 
@@ -1149,11 +1679,20 @@ void initialize_photon(double alpha, double beta, double photon_u[8],
     k_d[2] =
         sign(beta) * sqrt(fabs(Q1 - L1 * L1 * (cosc2 / sinc2) + E2 * cosc2));
 
+    photon_from_BL(Xcam_u, k_d, photon_u);
+}
+
+// Builds the photon at the BL position X_u (r not in log scale) from its
+// covariant k_t, k_theta and k_phi; k^r follows from the null condition and
+// points outwards. The result is converted to the coordinates in use
+void photon_from_BL(double X_u[4], double k_d[4], double photon_u[8]) {
+    double k_u[4];
+
     // Construct contravariant wave vector k_u using the BL metric
-    double r = logscale ? (rcam) : rcam;
+    double r = X_u[1];
     double rfactor = logscale ? r : 1.;
 
-    double theta = acos(mu0);
+    double theta = X_u[2];
     double sint = sin(theta);
     double cost = cos(theta);
     double sigma = r * r + a * a * cost * cost;
@@ -1174,52 +1713,134 @@ void initialize_photon(double alpha, double beta, double photon_u[8],
         sqrt((-k_u[0] * k_d[0] - k_u[2] * k_d[2] - k_u[3] * k_d[3]) / g_dd_11);
 
     // Place wave vector into "photon_u"
-    photon_u[0] = Xcam_u[0];
-    photon_u[1] = Xcam_u[1];
-    photon_u[2] = Xcam_u[2];
-    photon_u[3] = Xcam_u[3];
+    photon_u[0] = X_u[0];
+    photon_u[1] = logscale ? log(r) : r;
+    photon_u[2] = X_u[2];
+    photon_u[3] = X_u[3];
     photon_u[4] = k_u[0];
     photon_u[5] = k_u[1];
     photon_u[6] = k_u[2];
     photon_u[7] = k_u[3];
 
-// Convert k_u to the coordinate system that is currently used
-#if (metric == KS || metric == MKS || metric == MKSHARM || metric == MKSN ||   \
-     metric == CKS || metric == MKSBHAC)
-
-    double KSphoton_u[8];
-    BL_to_KS_u(photon_u, KSphoton_u);
-    LOOP_i {
-        photon_u[i] = KSphoton_u[i];
-        photon_u[i + 4] = KSphoton_u[i + 4];
-    }
+    // Convert k_u to the coordinate system that is currently used
+    BL_to_code_u(photon_u, photon_u);
+    // printf("\n INITIAL NORM = %+.15e", inner_product(X_u, k_u, k_u));
+}
 
-#endif
+// Radial potential R(r) of a photon with E = 1, angular momentum L and Carter
+// constant Q
+static double radial_potential(double r, double L, double Q) {
+    double P = r * r + a * a - a * L;
+    return P * P - (r * r + a * a - 2. * r) * ((L - a) * (L - a) + Q);
+}
 
-#if (metric == MKSHARM || metric == MKSBHAC)
+// Right-hand side of the polar motion in Mino time for u = cos(theta):
+// y = {u, du/dlambda, phi_theta, t_theta}. Using u keeps the equation
+// polynomial, so turning points and pole passages need no special care
+static void polar_rhs(double y[4], double L, double Q, double dy[4]) {
+    double u2 = y[0] * y[0];
+    dy[0] = y[1];
+    dy[1] = y[0] * (a * a - Q - L * L) - 2. * a * a * u2 * y[0];
+    dy[2] = L / (1. - u2) - a;
+    dy[3] = a * L - a * a * (1. - u2);
+}
 
-    photon_u[2] =
-        Xg2_approx_rand(photon_u[2]); // We only transform theta - r is
-                                      // already exponential and R0 = 0
+// Initializes the photon of impact parameters alpha and beta where it
+// crosses the sphere r_start on its way in from the camera, so that the
+// vacuum in between does not have to be integrated numerically. The
+// geodesic is followed in Mino time using E, L and Q: the radial integrals
+// are done by quadrature in s, with 1/r = 1/r_start - (1/r_start -
+// 1/rcam) s^2 to regularize a turning point at r_start, and the polar motion
+// is integrated with RK4, counting its turning points in theta_turns.
+// Returns 0 if the photon never reaches r_start.
+int initialize_photon_at(double alpha, double beta, double photon_u[8],
+                         double t_init, double r_start, int *theta_turns) {
+    *theta_turns = 0;
+    if (r_start >= rcam) {
+        initialize_photon(alpha, beta, photon_u, t_init);
+        return 1;
+    }
 
-    photon_u[6] =
-        Ug2_approx_rand(photon_u[6],
-                        photon_u[2]); // We only transform theta - r is
-                                      // already exponential and R0 = 0
-#endif
+    double mu0 = cos(INCLINATION / 180. * M_PI);
+    double theta0 = acos(mu0);
+    double L = -alpha * sqrt(1. - mu0 * mu0);
+    double Q = beta * beta + mu0 * mu0 * (alpha * alpha - 1.);
+    double cot0 = mu0 / sin(theta0);
+    double k_theta0 =
+        sign(beta) * sqrt(fabs(Q - L * L * cot0 * cot0 + mu0 * mu0));
+
+    // Carter constant of the photon as initialize_photon launches it
+    Q = k_theta0 * k_theta0 - mu0 * mu0 * (a * a - L * L / (1. - mu0 * mu0));
+
+    if (radial_potential(r_start, L, Q) <= 0.)
+        return 0;
+
+    // Radial integrals from r_start to rcam of dr / sqrt(R) (Mino time),
+    // of the radial parts of dphi and dt, the latter minus its leading
+    // terms 1 + 2 / r which are integrated exactly
+    int N = 512;
+    double us = 1. / r_start, uc = 1. / rcam;
+    double tau = 0., phi_r = 0., t_r = 0.;
+    for (int i = 1; i <= N; i++) {
+        double s = (double)i / N;
+        double w = (i == N) ? 1. : (i % 2 ? 4. : 2.);
+        double u = us - (us - uc) * s * s;
+        double r = 1. / u;
+        double R = radial_potential(r, L, Q);
+        if (R <= 0.)
+            return 0;
+        double P = r * r + a * a - a * L;
+        double delta = r * r + a * a - 2. * r;
+        double drds = 2. * (us - uc) * s * r * r;
+
+        tau += w * drds / sqrt(R);
+        phi_r += w * drds * a * P / (delta * sqrt(R));
+        t_r += w * drds * ((r * r + a * a) * P / (delta * sqrt(R)) - 1. -
+                           2. / r);
+    }
+    tau /= 3. * N;
+    phi_r /= 3. * N;
+    t_r = t_r / (3. * N) + (rcam - r_start) + 2. * log(rcam / r_start);
+
+    // Polar motion over the same Mino time; rays move backwards in time, so
+    // lambda runs from 0 to -tau. Steps are kept small near the poles, where
+    // dphi/dlambda peaks
+    double y[4] = {mu0, -sin(theta0) * k_theta0, 0., 0.};
+    double lambda = 0.;
+    double h_max = tau / 64.;
+    while (lambda < tau) {
+        double h = fmin(h_max, tau - lambda);
+        if (L != 0.)
+            h = fmin(h, fmax(0.02 * (1. - y[0] * y[0]) / fabs(L), 1e-6 * tau));
+
+        double k1[4], k2[4], k3[4], k4[4], yt[4];
+        polar_rhs(y, L, Q, k1);
+        LOOP_i yt[i] = y[i] - 0.5 * h * k1[i];
+        polar_rhs(yt, L, Q, k2);
+        LOOP_i yt[i] = y[i] - 0.5 * h * k2[i];
+        polar_rhs(yt, L, Q, k3);
+        LOOP_i yt[i] = y[i] - h * k3[i];
+        polar_rhs(yt, L, Q, k4);
+        double dmu_prev = y[1];
+        LOOP_i y[i] -= h / 6. * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+        lambda += h;
+        if (dmu_prev * y[1] < 0.)
+            (*theta_turns)++;
+    }
 
-#if (metric == CKS)
-    double photon_u_KS[8];
+    // Restore du/dlambda from the polar potential, keeping the sign found by
+    // the integration
+    double mu = fmax(-1., fmin(1., y[0]));
+    double Theta_u = (1. - mu * mu) * (Q + a * a * mu * mu) - L * L * mu * mu;
+    double dmu = (y[1] < 0. ? -1. : 1.) * sqrt(fmax(Theta_u, 0.));
 
-    LOOP_i {
-        photon_u_KS[i] = photon_u[i];
-        photon_u_KS[i + 4] = photon_u[i + 4];
-    }
+    double theta = acos(mu);
+    double X_u[4] = {t_init - t_r + y[3], r_start, theta, -phi_r + y[2]};
+    double k_d[4] = {-1., 0., -dmu / sin(theta), L};
 
-    KS_to_CKS_u(photon_u_KS, photon_u);
+    photon_from_BL(X_u, k_d, photon_u);
 
-#endif
-    // printf("\n INITIAL NORM = %+.15e", inner_product(Xcam_u, k_u, k_u));
+    return 1;
 }
 
 // Initialize photon using a simple Euclidean virtual camera consisting of eye
@@ -150,7 +150,9 @@ double rho_Q_power(double theta_e, double n_e, double nu, double B,
 }
 
 double rho_Q(double theta_e, double n_e, double nu, double B, double theta_B) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_RQ, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return rho_Q_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return rho_Q_power(theta_e, n_e, nu, B, theta_B);
@@ -248,7 +250,9 @@ double rho_V_power(double theta_e, double n_e, double nu, double B,
            sin(theta_B);
 }
 double rho_V(double theta_e, double n_e, double nu, double B, double theta_B) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_RV, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return rho_V_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return rho_V_power(theta_e, n_e, nu, B, theta_B);
@@ -322,7 +326,9 @@ double j_I(double theta_e, double n_e, double nu, double B, double theta_B) {
 
     double j_I = 0;
 
-#if (SYNCHROTRON && DF == KAPPA)
+#if (SYNCHROTRON && EMIS_TABLE && DF != TH)
+    j_I += emission_table(DF, TAB_JI, theta_e, n_e, nu, B, theta_B);
+#elif (SYNCHROTRON && DF == KAPPA)
     j_I += j_I_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (SYNCHROTRON && DF == POWER)
     j_I += j_I_power(theta_e, n_e, nu, B, theta_B);
@@ -398,7 +404,9 @@ double j_Q_power(double theta_e, double n_e, double nu, double B,
 }
 
 double j_Q(double theta_e, double n_e, double nu, double B, double theta_B) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_JQ, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return j_Q_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return j_Q_power(theta_e, n_e, nu, B, theta_B);
@@ -475,7 +483,9 @@ double j_V_power(double theta_e, double n_e, double nu, double B,
 
 double j_V(double theta_e, double n_e, double nu, double B, double theta_B) {
 
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_JV, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return j_V_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return j_V_power(theta_e, n_e, nu, B, theta_B);
@@ -568,7 +578,9 @@ double a_I_power(double theta_e, double n_e, double nu, double B,
 
 double a_I(double theta_e, double n_e, double nu, double B, double theta_B,
            double j_I_thermal) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_AI, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return a_I_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return a_I_power(theta_e, n_e, nu, B, theta_B);
@@ -632,7 +644,9 @@ double a_Q_power(double theta_e, double n_e, double nu, double B,
 
 double a_Q(double theta_e, double n_e, double nu, double B, double theta_B,
            double j_Q_thermal) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_AQ, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return a_Q_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return a_Q_power(theta_e, n_e, nu, B, theta_B);
@@ -714,7 +728,9 @@ double a_V_power(double theta_e, double n_e, double nu, double B,
 
 double a_V(double theta_e, double n_e, double nu, double B, double theta_B,
            double j_V_thermal) {
-#if (DF == KAPPA)
+#if (EMIS_TABLE && DF != TH)
+    return emission_table(DF, TAB_AV, theta_e, n_e, nu, B, theta_B);
+#elif (DF == KAPPA)
     return a_V_kappa(theta_e, n_e, nu, B, theta_B);
 #elif (DF == POWER)
     return a_V_power(theta_e, n_e, nu, B, theta_B);
@@ -784,3 +800,149 @@ double j_bremss(double nu, double n_e, double theta_e)
 #endif 
 
 }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// FUSED THERMAL KERNEL
+
+// Exponentially scaled modified Bessel functions K_n(x) e^x, n = 0, 1, 2.
+// GSL for x <= 2, the hot plasma; above, the polynomial approximations of
+// Abramowitz & Stegun 9.8.7-9.8.8 (relative error < 2e-7). K_2 from the
+// recurrence. The scaling keeps the ratios finite in cold plasma, where
+// K_n(1 / theta_e) underflows.
+void bessel_K012_scaled(double x, double K[3]) {
+    if (x <= 2.) {
+        K[0] = gsl_sf_bessel_K0_scaled(x);
+        K[1] = gsl_sf_bessel_K1_scaled(x);
+    } else {
+        double y = 2. / x;
+        double rx = 1. / sqrt(x);
+        K[0] = rx * (1.25331414 +
+                     y * (-0.07832358 +
+                          y * (0.02189568 +
+                               y * (-0.01062446 +
+                                    y * (0.00587872 +
+                                         y * (-0.00251540 + y * 0.00053208))))));
+        K[1] = rx * (1.25331414 +
+                     y * (0.23498619 +
+                          y * (-0.03655620 +
+                               y * (0.01504268 +
+                                    y * (-0.00780353 +
+                                         y * (0.00325614 + y * -0.00068245))))));
+    }
+    K[2] = K[0] + 2. / x * K[1];
+}
+
+// All thermal synchrotron (+ bremsstrahlung) coefficients at one fluid state
+// for n_nu plasma-frame frequencies, in the same units as j_I_thermal etc.
+// Everything that only depends on the fluid state is computed once.
+void thermal_coeffs(double theta_e, double n_e, double B, double theta_B,
+                    const double *nu, int n_nu, double *jI, double *jQ,
+                    double *jV, double *aI, double *aQ, double *aV, double *rQ,
+                    double *rV) {
+    double sin_B = sin(theta_B);
+    double cos_B = cos(theta_B);
+    double e2 = ELECTRON_CHARGE * ELECTRON_CHARGE;
+    double mc2 = ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT;
+
+    // synchrotron emission
+    double nu_c = 3.0 * ELECTRON_CHARGE * B * sin_B /
+                  (4.0 * M_PI * ELECTRON_MASS * SPEED_OF_LIGHT) * theta_e *
+                  theta_e;
+    double j_fac =
+        n_e * e2 / (2. * sqrt(3.) * SPEED_OF_LIGHT * theta_e * theta_e);
+    double V_fac = 4. * cos_B / (3. * theta_e * sin_B);
+
+    // Faraday rotation and conversion
+    double K[3];
+    bessel_K012_scaled(1. / theta_e, K);
+    double wp2 = 4. * M_PI * n_e * e2 / ELECTRON_MASS;
+    double omega0 = ELECTRON_CHARGE * B / ELECTRON_MASS / SPEED_OF_LIGHT;
+    double Xe_fac = theta_e * sqrt(sqrt(2.) * sin_B * 1.e3 * omega0 / 2. / M_PI);
+    double rQ_fac = wp2 * omega0 * omega0 * sin_B * sin_B /
+                    (2. * SPEED_OF_LIGHT * pow(2. * M_PI, 3.)) *
+                    (K[1] / K[2] + 6. * theta_e);
+    double rV_fac =
+        wp2 * omega0 * cos_B / (SPEED_OF_LIGHT * 4. * M_PI * M_PI);
+
+    // bremsstrahlung, Straub+ 2012 as in j_bremss
+#if (BREMSSTRAHLUNG)
+    double br_fac = 0.;
+    if (theta_e >= THETAE_MIN) {
+        double Fei, Fee;
+        double SOMMERFELD_ALPHA = 1. / 137.036;
+        double eta = 0.5616;
+        double e_charge = 4.80e-10; // in esu
+        double re = e_charge * e_charge / mc2;
+
+        if (theta_e < 1) {
+            Fei = 4. * sqrt(2. * theta_e / M_PI / M_PI / M_PI) *
+                  (1. + 1.781 * pow(theta_e, 1.34));
+            Fee = 20. / 9. / sqrt(M_PI) * (44. - 3. * M_PI * M_PI) *
+                  pow(theta_e, 1.5);
+            Fee *= (1. + 1.1 * theta_e + theta_e * theta_e -
+                    1.25 * pow(theta_e, 2.5));
+        } else {
+            Fei = 9. * theta_e / (2. * M_PI) *
+                  (log(1.123 * theta_e + 0.48) + 1.5);
+            Fee = 24. * theta_e * (log(2. * eta * theta_e) + 1.28);
+        }
+        br_fac = n_e * n_e * SOMMERFELD_ALPHA * mc2 * SPEED_OF_LIGHT *
+                 (SIGMA_THOMSON * Fei + re * re * Fee) / (4. * M_PI) *
+                 PLANCK_CONSTANT / (theta_e * mc2);
+    }
+#endif
+
+    for (int f = 0; f < n_nu; f++) {
+        double x = nu[f] / nu_c;
+        double x13 = cbrt(x);
+        double xm13 = 1. / x13;
+        double xm23 = xm13 * xm13;
+        double ex = exp(-1.8899 * x13);
+
+        jQ[f] = j_fac * nu[f] * 2.5651 *
+                (1 + 0.93193 * xm13 + 0.499873 * xm23) * ex;
+        jV[f] = j_fac * nu[f] * V_fac *
+                (1.81348 / x + 3.42319 * xm23 + 0.0292545 / sqrt(x) +
+                 2.03773 * xm13) *
+                ex;
+
+        // Planck function and bremsstrahlung share exp(h nu / k T)
+        double x_h = PLANCK_CONSTANT * nu[f] / (theta_e * mc2);
+        double e_h = exp(x_h);
+        double B_nu = 2. * PLANCK_CONSTANT * nu[f] * nu[f] * nu[f] /
+                      (SPEED_OF_LIGHT * SPEED_OF_LIGHT) / (e_h - 1.);
+
+        double j_br = 0.;
+#if (BREMSSTRAHLUNG)
+        double efac = (x_h < 1.e-3) ? (24. - 24. * x_h + 12. * x_h * x_h -
+                                       4. * x_h * x_h * x_h +
+                                       x_h * x_h * x_h * x_h) /
+                                          24.
+                                    : 1. / e_h;
+        double gff = (x_h > 1) ? sqrt(3. / M_PI / x_h)
+                               : sqrt(3.) / M_PI * log(4 / 0.577 / x_h);
+        j_br = br_fac * efac * gff;
+#endif
+
+        double j_syn = 0.;
+#if (SYNCHROTRON)
+        j_syn = j_fac * nu[f] * 2.5651 * (1 + 1.92 * xm13 + 0.9977 * xm23) *
+                ex;
+#endif
+        jI[f] = j_br + j_syn;
+        aI[f] = jI[f] / (B_nu + 1.e-100);
+        aQ[f] = jQ[f] / B_nu;
+        aV[f] = jV[f] / B_nu;
+
+        double Xe = Xe_fac / sqrt(nu[f]);
+        double nu2 = nu[f] * nu[f];
+        rQ[f] = rQ_fac / (nu2 * nu[f]) * f_m(Xe);
+#if (DEXTER)
+        rV[f] = rV_fac / nu2 *
+                (K[0] - DeltaJ_5(Xe) * exp(1. / theta_e)) / K[2];
+#else
+        rV[f] = rV_fac / nu2 * K[0] / K[2] * (1 - 0.11 * log(1 + 0.035 * Xe));
+#endif
+    }
+}
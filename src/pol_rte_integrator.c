@@ -16,73 +16,52 @@
 ////////////
 
 // y contains the 4-position and the 4-velocity for one lightray/particle.
-void f_parallel(double y[], double complex f_u[], double fvector[],
-                double complex f_u_vector[]) {
-    // Create variable (on the stack) for the connection
-    double gamma_udd[4][4][4];
-    // Einstein summation over indices v and w
-
-    LOOP_ijk gamma_udd[i][j][k] = 0.;
-
+// Returns the geodesic right-hand side in fvector and the matrix A_f that
+// maps f_u onto its derivative, df^i/dlambda = A_f[i][k] f^k.
+void f_parallel(double y[], double fvector[], double A_f[4][4]) {
     // Initialize position, four-velocity, and four-acceleration vectors based
     // on values of y
     double X_u[4] = {y[0], y[1], y[2], y[3]}; // X
     double U_u[4] = {y[4], y[5], y[6], y[7]}; // dX/dLambda
-    double complex A_u[4] = {0., 0., 0., 0.}; // d^2X/dLambda^2
-
-    // Obtain the Christoffel symbols at the current location
-#if (metric == MKSBHAC || metric == MKSHARM)
-    connection_udd(X_u, gamma_udd);
-#else
-    connection_num_udd(X_u, gamma_udd);
-#endif
+    double A_u[4];                            // d^2X/dLambda^2
 
-    // Compute 4-acceleration using the geodesic equation
-    LOOP_ijk A_u[i] -= gamma_udd[i][j][k] * U_u[j] * U_u[k];
+    // 4-acceleration from the geodesic equation, and the f_u vector
+    // acceleration
+    geodesic_accel(X_u, U_u, A_u, A_f);
     LOOP_i {
         fvector[i] = U_u[i];
         fvector[i + 4] = A_u[i];
     }
-
-    // Reset A_u
-    LOOP_i A_u[i] = 0.;
-
-    // Compute f_u vector acceleration
-    LOOP_ijk A_u[i] -= gamma_udd[i][j][k] * U_u[j] * f_u[k];
-    LOOP_i { f_u_vector[i] = A_u[i]; }
 }
 
-void rk4_step_f(double y[], double complex f_u[], double dt) {
+// Parallel transports f_u of all active frequencies one RK4 step along the
+// ray. The transport is linear in f_u and does not depend on the frequency,
+// so the RK4 propagator is built once from four connection evaluations and
+// then applied to every frequency.
+void rk4_step_f(double y[], double complex f_u[][4], int active[],
+                double dt) {
     // Array containing all "update elements" (4 times Nelements because RK4)
     double dx[4 * 2 * 4];
-    double complex df[4 * 4];
+    double A_f[4][4][4];
 
     // Create a copy of the "y vector" that can be shifted for the
     // separate function calls made by RK4
     double yshift[4 * 2] = {y[0], y[1], y[2], y[3], y[4], y[5], y[6], y[7]};
-    double complex f_u_shift[4] = {f_u[0], f_u[1], f_u[2], f_u[3]};
 
     // fvector contains f(yshift), as applied to yshift (the 'current' y
     // during RK steps). It is used to compute the 'k-coefficients' (dx)
     double fvector[4 * 2];
-    double complex f_u_vector[4];
 
     // Compute the RK4 update coefficients ('K_n' in lit., 'dx' here)
     int i, q;
-    double complex weights[4] = {0.5, 0.5, 1.,
-                                 0.}; // Weights used for updating y
+    double weights[4] = {0.5, 0.5, 1., 0.}; // Weights used for updating y
     for (q = 0; q < 4; q++) {
-        f_parallel(
-            yshift, f_u_shift, fvector,
-            f_u_vector); // Apply function f to current y to obtain fvector
+        f_parallel(yshift, fvector,
+                   A_f[q]); // Apply function f to current y to obtain fvector
         for (i = 0; i < 4 * 2; i++) {
             dx[q * 4 * 2 + i] = dt * fvector[i]; // Use fvector to fill dx
             yshift[i] = y[i] + dx[q * 4 * 2 + i] * weights[q]; // Update y
         }
-        for (i = 0; i < 4; i++) {
-            df[q * 4 + i] = dt * f_u_vector[i];
-            f_u_shift[i] = f_u[i] + df[q * 4 + i] * weights[q];
-        }
     }
 
     // Update the y-vector (light ray)
@@ -92,11 +71,35 @@ void rk4_step_f(double y[], double complex f_u[], double dt) {
                            dx[2 * 4 * 2 + i] * 2. + dx[3 * 4 * 2 + i]);
     }
 
+    // Propagator of the f-vector, built column by column from the RK4
+    // stages applied to the unit vectors
+    double prop[4][4];
+    for (int col = 0; col < 4; col++) {
+        double f_shift[4], df[4][4];
+        LOOP_i f_shift[i] = (i == col);
+        for (q = 0; q < 4; q++) {
+            LOOP_i {
+                df[q][i] = 0.;
+                for (int k = 0; k < 4; k++)
+                    df[q][i] += dt * A_f[q][i][k] * f_shift[k];
+            }
+            LOOP_i f_shift[i] = (i == col) + df[q][i] * weights[q];
+        }
+        LOOP_i prop[i][col] =
+            (i == col) +
+            1. / 6. * (df[0][i] + df[1][i] * 2. + df[2][i] * 2. + df[3][i]);
+    }
+
     // Update the f-vector (polarization)
-    for (i = 0; i < 4; i++) {
-        f_u[i] = f_u[i] + 1. / 6. *
-                              (df[0 * 4 + i] + df[1 * 4 + i] * 2. +
-                               df[2 * 4 + i] * 2. + df[3 * 4 + i]);
+    for (int f = 0; f < num_frequencies; f++) {
+        if (!active[f])
+            continue;
+        double complex f_old[4] = {f_u[f][0], f_u[f][1], f_u[f][2], f_u[f][3]};
+        LOOP_i {
+            f_u[f][i] = 0.;
+            for (int k = 0; k < 4; k++)
+                f_u[f][i] += prop[i][k] * f_old[k];
+        }
     }
 }
 
@@ -238,6 +241,26 @@ void evaluate_coeffs_user(double *jI, double *jQ, double *jU, double *jV,
     aQ_thermal = a_Q_thermal(modvar.theta_e, modvar.n_e, nu_p, modvar.B,
                              pitch_ang, jQ_thermal);
 
+#if (EMIS_TABLE)
+    jI_kappa = emission_table(KAPPA, TAB_JI, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+    jV_kappa = emission_table(KAPPA, TAB_JV, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+    jQ_kappa = emission_table(KAPPA, TAB_JQ, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+
+    aI_kappa = emission_table(KAPPA, TAB_AI, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+    aV_kappa = emission_table(KAPPA, TAB_AV, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+    aQ_kappa = emission_table(KAPPA, TAB_AQ, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+
+    rV_kappa = emission_table(KAPPA, TAB_RV, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+    rQ_kappa = emission_table(KAPPA, TAB_RQ, modvar.theta_e, modvar.n_e, nu_p,
+                              modvar.B, pitch_ang);
+#else
     jI_kappa = j_I_kappa(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
     jV_kappa = j_V_kappa(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
     jQ_kappa = j_Q_kappa(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
@@ -250,6 +273,7 @@ void evaluate_coeffs_user(double *jI, double *jQ, double *jU, double *jV,
         rho_V_kappa(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
     rQ_kappa =
         rho_Q_kappa(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+#endif
     rV_thermal =
         rho_V_thermal(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
     rQ_thermal =
@@ -306,68 +330,10 @@ void evaluate_coeffs_user(double *jI, double *jQ, double *jU, double *jV,
     }
 }
 
-void evaluate_coeffs_single(double *jI, double *jQ, double *jU, double *jV,
-                            double *rQ, double *rU, double *rV, double *aI,
-                            double *aQ, double *aU, double *aV, double nu_p,
-                            struct GRMHD modvar, double pitch_ang, int rmin, double r_current) {
-
-    *jI = 0;
-    *aI = 0;
-
-    if(rmin == 5 && r_current <= 30){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-    else if(rmin == 4 && r_current > 30 && r_current <= 60){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-    else if(rmin == 3 && r_current > 60 && r_current <= 240){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-    else if(rmin == 2 && r_current > 240 && r_current <= 960){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-    if(rmin == 1 && r_current > 960){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-     if(rmin == 0){
-        *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-        *jU = 0.;
-        *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    }
-
-    double jIdummy = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-
-    *rQ = rho_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-    *rU = 0.;
-    *rV = rho_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
-
-    *aI = a_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, *jI);
-    *aQ = a_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, *jQ);
-    *aU = 0;
-    *aV = a_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, *jV);
-
-    // Transform to invariant forms
+// Transforms the coefficients at plasma frequency nu_p to invariant forms
+void invariant_coeffs(double *jI, double *jQ, double *jU, double *jV,
+                      double *rQ, double *rU, double *rV, double *aI,
+                      double *aQ, double *aU, double *aV, double nu_p) {
     *jI /= (nu_p * nu_p);
     *jQ /= (nu_p * nu_p);
     *jV /= (nu_p * nu_p);
@@ -390,14 +356,65 @@ void evaluate_coeffs_single(double *jI, double *jQ, double *jU, double *jV,
         *jU /= (pol_frac + 0.005);
         *jV /= (pol_frac + 0.005);
     }
-    /*
-        pol_frac = sqrt((*aQ) * (*aQ) + (*aV) * (*aV)) / (*aI);
-        if (pol_frac > 1.) {
-            *aQ *= (pol_frac - 0.005);
-            *aU *= (pol_frac - 0.005);
-            *aV *= (pol_frac - 0.005);
-        }
-    */
+}
+
+void evaluate_coeffs_single(double *jI, double *jQ, double *jU, double *jV,
+                            double *rQ, double *rU, double *rV, double *aI,
+                            double *aQ, double *aU, double *aV, double nu_p,
+                            struct GRMHD modvar, double pitch_ang) {
+
+    *jI = j_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+    *jQ = j_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+    *jU = 0.;
+    *jV = j_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+
+    // synchrotron part of j_I; a_I_thermal adds the bremsstrahlung itself
+    double jI_syn = *jI;
+#if (DF == TH && BREMSSTRAHLUNG)
+    jI_syn -= j_bremss(nu_p, modvar.n_e, modvar.theta_e);
+#endif
+
+    *rQ = rho_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+    *rU = 0.;
+    *rV = rho_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang);
+
+    *aI = a_I(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, jI_syn);
+    *aQ = a_Q(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, *jQ);
+    *aU = 0;
+    *aV = a_V(modvar.theta_e, modvar.n_e, nu_p, modvar.B, pitch_ang, *jV);
+
+    invariant_coeffs(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV, nu_p);
+}
+
+// Invariant coefficients at the n_nu plasma frequencies nu_p of one step. For
+// thermal electrons the fused kernel shares the fluid-state work between all
+// coefficients and frequencies.
+void evaluate_coeffs_batch(double jI[], double jQ[], double jU[], double jV[],
+                           double rQ[], double rU[], double rV[], double aI[],
+                           double aQ[], double aU[], double aV[],
+                           double nu_p[], int n_nu, struct GRMHD modvar,
+                           double pitch_ang) {
+#if (EMISUSER)
+    for (int f = 0; f < n_nu; f++)
+        evaluate_coeffs_user(&jI[f], &jQ[f], &jU[f], &jV[f], &rQ[f], &rU[f],
+                             &rV[f], &aI[f], &aQ[f], &aU[f], &aV[f], nu_p[f],
+                             modvar, pitch_ang);
+#elif (DF == TH)
+    thermal_coeffs(modvar.theta_e, modvar.n_e, modvar.B, pitch_ang, nu_p, n_nu,
+                   jI, jQ, jV, aI, aQ, aV, rQ, rV);
+    for (int f = 0; f < n_nu; f++) {
+        jU[f] = 0.;
+        rU[f] = 0.;
+        aU[f] = 0.;
+        invariant_coeffs(&jI[f], &jQ[f], &jU[f], &jV[f], &rQ[f], &rU[f],
+                         &rV[f], &aI[f], &aQ[f], &aU[f], &aV[f], nu_p[f]);
+    }
+#else
+    for (int f = 0; f < n_nu; f++)
+        evaluate_coeffs_single(&jI[f], &jQ[f], &jU[f], &jV[f], &rQ[f], &rU[f],
+                               &rV[f], &aI[f], &aQ[f], &aU[f], &aV[f], nu_p[f],
+                               modvar, pitch_ang);
+#endif
 }
 int check_stiffness(double jI, double jQ, double jU, double jV, double rQ,
                     double rU, double rV, double aI, double aQ, double aU,
@@ -602,17 +619,28 @@ void stokes_to_f(double complex f_u[], double complex f_tetrad_u[],
     f_tetrad_to_f(f_u, tetrad_u, f_tetrad_u);
 }
 
-void pol_integration_step(struct GRMHD modvar, double frequency,
-                          double *dl_current, double C, double X_u[],
-                          double k_u[], double k_d[], int *POLARIZATION_ACTIVE,
-                          double complex f_u[], double complex f_tetrad_u[],
-                          double tetrad_d[][4], double tetrad_u[][4],
-                          double complex S_A[], double *Iinv, double *Iinv_pol,
-                          double *tau, double *tauF) {
-
-    double jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV;
-    double pitch_ang, nu_p;
-    double k_u_old[4];
+// Performs one radiative transfer step at all frequencies. Pitch angle,
+// plasma-frame redshift and the tetrads only depend on the direction of k_u,
+// so they are computed once; only the coefficients and the Stokes update are
+// done per frequency.
+void pol_integration_step(struct GRMHD modvar, double *frequency,
+                          double dl_current, double C, double X_u[],
+                          double k_u[], int POLARIZATION_ACTIVE[],
+                          double complex f_u[][4], double complex S_A[][4],
+                          double Iinv[], double Iinv_pol[], double tau[],
+                          double tauF[]) {
+
+    double jI[num_frequencies], jQ[num_frequencies], jU[num_frequencies],
+        jV[num_frequencies];
+    double rQ[num_frequencies], rU[num_frequencies], rV[num_frequencies];
+    double aI[num_frequencies], aQ[num_frequencies], aU[num_frequencies],
+        aV[num_frequencies];
+    double dl[num_frequencies];
+    double pitch_ang;
+    double k_d[4];
+    double tetrad_u[4][4], tetrad_d[4][4];
+    double complex f_tetrad_u[4] = {0., 0., 0., 0.};
+
     // Unpolarized: 1) Create light path by integration. 2) For each
     // step in lightpath, perform one radiative transfer step.
     // Polarized:   1) Create light path by integration. 2) For each
@@ -631,164 +659,229 @@ void pol_integration_step(struct GRMHD modvar, double frequency,
 
     // CGS UNITS USED FROM HERE ON OUT
     //////////////////////////////////
-    LOOP_i k_u_old[i] = k_u[i];
-    // Scale the wave vector to correct energy
-    LOOP_i k_u[i] *= PLANCK_CONSTANT * frequency /
-                     (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
-
-    // Convert distance dlambda accordingly
-    *dl_current *= (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT) /
-                   (PLANCK_CONSTANT * frequency);
-    double scale = L_unit * PLANCK_CONSTANT /
-               (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+
     // lower the index of the wavevector
     lower_index(X_u, k_u, k_d);
 
-    // Compute the photon frequency in the plasma frame:
-    nu_p = freq_in_plasma_frame(modvar.U_u, k_d);
+    // Plasma frame frequency per unit observed frequency; the wave vector
+    // scales with PLANCK_CONSTANT * frequency / (ELECTRON_MASS * c^2)
+    double redshift = freq_in_plasma_frame(modvar.U_u, k_d) * PLANCK_CONSTANT /
+                      (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+
+    double scale = L_unit * PLANCK_CONSTANT /
+                   (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
 
     // POLARIZED EMISSION/ABSORPTION COEFFS
     ///////////////////////////////////////
-int rmin_dum = 0; // garbage values 
-double r_current_dum = 0; //garbage values
+    double nu_p[num_frequencies];
 
-#if (EMISUSER)
-              	evaluate_coeffs_user(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                     &aQ, &aU, &aV, nu_p, modvar, pitch_ang);
-#else
-                evaluate_coeffs_single(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                       &aQ, &aU, &aV, nu_p, modvar, pitch_ang, rmin_dum, r_current_dum);
-#endif
+    for (int f = 0; f < num_frequencies; f++) {
+        nu_p[f] = frequency[f] * redshift;
+
+        // Convert distance dlambda accordingly
+        dl[f] = dl_current * (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT) /
+                (PLANCK_CONSTANT * frequency[f]);
+    }
 
+    evaluate_coeffs_batch(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV, nu_p,
+                          num_frequencies, modvar, pitch_ang);
 
     // Create tetrad, needed whether POLARIZATION_ACTIVE is true or
     // false.
     create_observer_tetrad(X_u, k_u, modvar.U_u, modvar.B_u, tetrad_u);
     create_tetrad_d(X_u, tetrad_u, tetrad_d);
 
-    // FROM F VECTOR TO STOKES (when applicable)
-    ////////////////////////////////////////////
+    for (int f = 0; f < num_frequencies; f++) {
+        // FROM F VECTOR TO STOKES (when applicable)
+        ////////////////////////////////////////////
 
-    // If (POLARIZATION_ACTIVE), get Stokes params from f_u and p.
-    // (Otherwise, never been in volume before; we simply use
-    // S_I_current)
-    if (*POLARIZATION_ACTIVE) {
-        f_to_stokes(f_u, f_tetrad_u, tetrad_d, S_A, *Iinv, *Iinv_pol);
-    }
-    // Given Stokes params and plasma coeffs, compute NEW Stokes params
-    // after plasma step.
-
-    int STIFF = check_stiffness(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV,
-                                *dl_current);
-
-    // If both rotation coeffs (times dlambda) are smaller than
-    // threshold, take an RK4 step; otherwise, implicit Euler.
-    // if (fabs(rQ) < THRESH && fabs(rV) < THRESH) {
-    if (!STIFF) {
-        pol_rte_rk4_step(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV,
-                         *dl_current, C, S_A);
-    } else {
-        pol_rte_trapezoid_step(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV,
-                               *dl_current, C, S_A);
-    }
-    // FROM STOKES TO F VECTOR
-    ///////////////////////////
-    // somtimes in very specific cells issue with Ipol>S_I, numerical round off
-    // issues? renormalizing.
-    double pol_frac =
-        sqrt(S_A[1] * S_A[1] + S_A[2] * S_A[2] + S_A[3] * S_A[3]) /
-        sqrt(S_A[0] * S_A[0]);
-
-    if (pol_frac > 1.) {
-        //         fprintf(stderr,"unphysical in pol step, skipping step. %e %e
-        //         %e\n", sqrt(S_A[0]*S_A[0]), sqrt(S_A[1] * S_A[1] + S_A[2] *
-        //         S_A[2] +
-        //       S_A[3] * S_A[3]),four_velocity_norm(X_u,k_u_old));
-        S_A[1] /= (pol_frac + 0.005);
-        S_A[2] /= (pol_frac + 0.005);
-        S_A[3] /= (pol_frac + 0.005);
-
-        //	return;
-    }
+        // If (POLARIZATION_ACTIVE), get Stokes params from f_u and p.
+        // (Otherwise, never been in volume before; we simply use
+        // S_I_current)
+        if (POLARIZATION_ACTIVE[f]) {
+            f_to_stokes(f_u[f], f_tetrad_u, tetrad_d, S_A[f], Iinv[f],
+                        Iinv_pol[f]);
+        }
+        // Given Stokes params and plasma coeffs, compute NEW Stokes params
+        // after plasma step.
+
+        int STIFF = check_stiffness(jI[f], jQ[f], jU[f], jV[f], rQ[f], rU[f],
+                                    rV[f], aI[f], aQ[f], aU[f], aV[f], dl[f]);
+
+        // If both rotation coeffs (times dlambda) are smaller than
+        // threshold, take an RK4 step; otherwise, implicit Euler.
+        if (!STIFF) {
+            pol_rte_rk4_step(jI[f], jQ[f], jU[f], jV[f], rQ[f], rU[f], rV[f],
+                             aI[f], aQ[f], aU[f], aV[f], dl[f], C, S_A[f]);
+        } else {
+            pol_rte_trapezoid_step(jI[f], jQ[f], jU[f], jV[f], rQ[f], rU[f],
+                                   rV[f], aI[f], aQ[f], aU[f], aV[f], dl[f], C,
+                                   S_A[f]);
+        }
+        // FROM STOKES TO F VECTOR
+        ///////////////////////////
+        // somtimes in very specific cells issue with Ipol>S_I, numerical round
+        // off issues? renormalizing.
+        double pol_frac = sqrt(S_A[f][1] * S_A[f][1] + S_A[f][2] * S_A[f][2] +
+                               S_A[f][3] * S_A[f][3]) /
+                          sqrt(S_A[f][0] * S_A[f][0]);
 
-    *Iinv = S_A[0];
-    *Iinv_pol = sqrt(S_A[1] * S_A[1] + S_A[2] * S_A[2] + S_A[3] * S_A[3]);
-    /*
-            fprintf(stderr,"r %e te %e th %e nu
-       %e\n",exp(X_u[1]),modvar.theta_e,pitch_ang,nu_p); fprintf(stderr,"B %e %e
-       %e %e\n",modvar.B_u[0],modvar.B_u[1],modvar.B_u[2],modvar.B_u[3]);
-            fprintf(stderr,"U %e %e %e
-       %e\n",modvar.U_u[0],modvar.U_u[1],modvar.U_u[2],modvar.U_u[3]);
-               fprintf(stderr,"k %e %e %e %e\n",k_u[0],k_u[1],k_u[2],k_u[3]);
-               fprintf(stderr,"Iinv %e Iinv_pol %e\n",*Iinv,*Iinv_pol);
-               fprintf(stderr,"jI %e jQ %e jU %e jV %e\n",jI,jQ,jU,jV);
-               fprintf(stderr,"aI %e aQ %e aU %e aV %e\n",aI,aQ,aU,aV);
-               fprintf(stderr,"rQ %e rU %e rV %e\n",rQ,rU,rV);
-
-            if(isnan(sqrt(S_A[0]*S_A[0])))
-                    exit(1);
-    */
-    //        check_tetrad_identities(X_u, tetrad_u);
-    //        check_tetrad_compact(X_u, tetrad_u);
-
-    // We have now updated the Stokes vector using plasma at current
-    // position. Only do stuff below this line IF S_A[0] > 1.e-40. If
-    // not, POLARIZATION_ACTIVE is set to FALSE and we reset S_A[i] = 0
-    if (*Iinv_pol > 1.e-100) {
-        stokes_to_f(f_u, f_tetrad_u, tetrad_u, S_A, Iinv, Iinv_pol);
-        *tau += aI * (*dl_current) * scale;
-        *tauF += fabs(rV) * (*dl_current) * scale;
-
-        // Set POLARIZATION_ACTIVE to true; we are, after all,
-        // in_volume.
-        *POLARIZATION_ACTIVE = 1;
+        if (pol_frac > 1.) {
+            S_A[f][1] /= (pol_frac + 0.005);
+            S_A[f][2] /= (pol_frac + 0.005);
+            S_A[f][3] /= (pol_frac + 0.005);
+        }
 
-    } else {
-        *POLARIZATION_ACTIVE = 0;
-        S_A[1] = 0.;
-        S_A[2] = 0.;
-        S_A[3] = 0.;
+        Iinv[f] = S_A[f][0];
+        Iinv_pol[f] = sqrt(S_A[f][1] * S_A[f][1] + S_A[f][2] * S_A[f][2] +
+                           S_A[f][3] * S_A[f][3]);
+
+        // We have now updated the Stokes vector using plasma at current
+        // position. Only do stuff below this line IF S_A[0] > 1.e-40. If
+        // not, POLARIZATION_ACTIVE is set to FALSE and we reset S_A[i] = 0
+        if (Iinv_pol[f] > 1.e-100) {
+            stokes_to_f(f_u[f], f_tetrad_u, tetrad_u, S_A[f], &Iinv[f],
+                        &Iinv_pol[f]);
+            tau[f] += aI[f] * dl[f] * scale;
+            tauF[f] += fabs(rV[f]) * dl[f] * scale;
+
+            // Set POLARIZATION_ACTIVE to true; we are, after all,
+            // in_volume.
+            POLARIZATION_ACTIVE[f] = 1;
+
+        } else {
+            POLARIZATION_ACTIVE[f] = 0;
+            S_A[f][1] = 0.;
+            S_A[f][2] = 0.;
+            S_A[f][3] = 0.;
+        }
     }
 }
 
-void construct_f_obs_tetrad_u(double *X_u, double *k_u, double complex *f_u,
-                              double complex *f_obs_tetrad_u) {
+void construct_obs_tetrad_d(double *X_u, double *k_u,
+                            double obs_tetrad_d[][4]) {
 
     double cam_up_u[4] = {0., 0., 0., -1.};
     double U_obs_u[4] = {0., 0., 0., 0.};
-    double obs_tetrad_u[4][4], obs_tetrad_d[4][4];
+    double obs_tetrad_u[4][4];
     LOOP_ij obs_tetrad_u[i][j] = 0.;
     LOOP_ij obs_tetrad_d[i][j] = 0.;
 
     construct_U_vector(X_u, U_obs_u);
     create_observer_tetrad(X_u, k_u, U_obs_u, cam_up_u, obs_tetrad_u);
     create_tetrad_d(X_u, obs_tetrad_u, obs_tetrad_d);
+}
+
+// Walker-Penrose constant {K1, K2} of the real vector f_u, orthogonal to the
+// wave vector of BLphoton_u, both in BL coordinates. It is conserved when
+// f_u is parallel transported along the geodesic
+void walker_penrose(double *BLphoton_u, double *f_u, double wp[2]) {
+    double r = logscale ? exp(BLphoton_u[1]) : BLphoton_u[1];
+    double rfactor = logscale ? r : 1.;
+    double sint = sin(BLphoton_u[2]);
+    double cost = cos(BLphoton_u[2]);
+    double k[4] = {BLphoton_u[4], BLphoton_u[5] * rfactor, BLphoton_u[6],
+                   BLphoton_u[7]};
+    double f[4] = {f_u[0], f_u[1] * rfactor, f_u[2], f_u[3]};
+
+    double A_ = k[0] * f[1] - k[1] * f[0] +
+                a * sint * sint * (k[1] * f[3] - k[3] * f[1]);
+    double B_ = ((r * r + a * a) * (k[3] * f[2] - k[2] * f[3]) -
+                 a * (k[0] * f[2] - k[2] * f[0])) *
+                sint;
+
+    // K1 + i K2 = (A - i B) (r - i a cos(theta))
+    wp[0] = r * A_ - a * cost * B_;
+    wp[1] = -(r * B_ + a * cost * A_);
+}
+
+// With FAST_FORWARD, f_u is known where the numerical lightpath starts
+// (entry 1), while the observer tetrad is at the camera (entry 0), across
+// the vacuum that was skipped. f_u is carried over by matching its
+// Walker-Penrose constant to that of a combination of the screen legs 1 and
+// 2 of the tetrad, whose coefficients are f_tetrad_u[1] and f_tetrad_u[2]
+void f_vacuum_to_f_tetrad(double *lightpath, double obs_tetrad_d[][4],
+                          double complex f_u[4],
+                          double complex f_tetrad_u[4]) {
+    double photon_u[8], BLphoton_u[8], BLcam_u[8], BLvec_u[8];
+    double wp_re[2], wp_im[2], M[2][2];
+
+    // Constant of f_u at entry 1, for its real and imaginary parts
+    code_to_BL_u(&lightpath[9], BLphoton_u);
+    LOOP_i {
+        photon_u[i] = lightpath[9 + i];
+        photon_u[i + 4] = creal(f_u[i]);
+    }
+    code_to_BL_u(photon_u, BLvec_u);
+    walker_penrose(BLphoton_u, &BLvec_u[4], wp_re);
+    LOOP_i photon_u[i + 4] = cimag(f_u[i]);
+    code_to_BL_u(photon_u, BLvec_u);
+    walker_penrose(BLphoton_u, &BLvec_u[4], wp_im);
+
+    // Constants of the screen legs at the camera
+    code_to_BL_u(lightpath, BLcam_u);
+    for (int leg = 1; leg < 3; leg++) {
+        double e_d[4], e_u[4], wp_leg[2];
+        LOOP_i e_d[i] = obs_tetrad_d[i][leg];
+        raise_index(lightpath, e_d, e_u);
+        LOOP_i {
+            photon_u[i] = lightpath[i];
+            photon_u[i + 4] = e_u[i];
+        }
+        code_to_BL_u(photon_u, BLvec_u);
+        walker_penrose(BLcam_u, &BLvec_u[4], wp_leg);
+        M[0][leg - 1] = wp_leg[0];
+        M[1][leg - 1] = wp_leg[1];
+    }
+
+    double complex K1 = wp_re[0] + I * wp_im[0];
+    double complex K2 = wp_re[1] + I * wp_im[1];
+    double det = M[0][0] * M[1][1] - M[0][1] * M[1][0];
+    double norm = fabs(M[0][0]) + fabs(M[0][1]) + fabs(M[1][0]) + fabs(M[1][1]);
 
-    // Convert f_u to f_obs_tetrad_u
-    LOOP_i f_obs_tetrad_u[i] = 0.;
-    LOOP_ij f_obs_tetrad_u[i] += obs_tetrad_d[j][i] * f_u[j];
+    LOOP_i f_tetrad_u[i] = 0.;
+    if (fabs(det) > 1e-12 * norm * norm) {
+        f_tetrad_u[1] = (M[1][1] * K1 - M[0][1] * K2) / det;
+        f_tetrad_u[2] = (M[0][0] * K2 - M[1][0] * K1) / det;
+    } else {
+        // Radial photons have a vanishing constant; they are not rotated
+        // by the vacuum, so f_u is projected where it is known
+        double tetrad_d[4][4];
+        construct_obs_tetrad_d(&lightpath[9], &lightpath[13], tetrad_d);
+        f_to_f_tetrad(f_tetrad_u, tetrad_d, f_u);
+    }
 }
 
+// Polarized transfer along the lightpath for all frequencies in a single
+// backward pass.
 void radiative_transfer_polarized(double *lightpath, int steps,
-                                  double frequency, double *f_x, double *f_y,
-                                  double *p, int PRINT_POLAR, double *IQUV,
-                                  double *tau, double *tauF) {
+                                  double *frequency, double *f_x, double *f_y,
+                                  double *p, int PRINT_POLAR,
+                                  double IQUV[num_frequencies][4],
+                                  double tau[num_frequencies],
+                                  double tauF[num_frequencies]) {
     int path_counter;
     double dl_current;
 
-    double X_u[4], k_u[4], k_d[4];
-
-    double Iinv, Iinv_pol;
-    int POLARIZATION_ACTIVE = 0;
+    double X_u[4], k_u[4];
 
-    double tetrad_u[4][4], tetrad_d[4][4];
-    LOOP_ij tetrad_u[i][j] = 0.;
-    LOOP_ij tetrad_d[i][j] = 0.;
+    double Iinv[num_frequencies], Iinv_pol[num_frequencies];
+    int POLARIZATION_ACTIVE[num_frequencies];
+    int ANY_ACTIVE = 0;
 
     double photon_u_current[8] = {0., 0., 0., 0., 0., 0., 0., 0.};
-    double complex f_tetrad_u[4] = {0., 0., 0., 0.};
-    double complex f_u[4] = {0., 0., 0., 0.};
-    double complex S_A[4] = {0., 0., 0., 0.};
+    double complex f_u[num_frequencies][4];
+    double complex S_A[num_frequencies][4];
+
+    for (int f = 0; f < num_frequencies; f++) {
+        Iinv[f] = 0.;
+        Iinv_pol[f] = 0.;
+        POLARIZATION_ACTIVE[f] = 0;
+        LOOP_i {
+            f_u[f][i] = 0.;
+            S_A[f][i] = 0.;
+        }
+    }
 
     struct GRMHD modvar;
     modvar.B = 0;
@@ -823,10 +916,13 @@ void radiative_transfer_polarized(double *lightpath, int steps,
 
         // Check whether the ray is currently in the GRMHD simulation volume
         if (get_fluid_params(X_u, &modvar) && r_current < RT_OUTER_CUTOFF) {
-            pol_integration_step(modvar, frequency, &dl_current, C_CONST, X_u,
-                                 k_u, k_d, &POLARIZATION_ACTIVE, f_u,
-                                 f_tetrad_u, tetrad_d, tetrad_u, S_A, &Iinv,
-                                 &Iinv_pol, tau, tauF);
+            pol_integration_step(modvar, frequency, dl_current, C_CONST, X_u,
+                                 k_u, POLARIZATION_ACTIVE, f_u, S_A, Iinv,
+                                 Iinv_pol, tau, tauF);
+
+            ANY_ACTIVE = 0;
+            for (int f = 0; f < num_frequencies; f++)
+                ANY_ACTIVE |= POLARIZATION_ACTIVE[f];
         } // End of if(IN_VOLUME)
 
         // SPACETIME-INTEGRATION STEP
@@ -836,7 +932,7 @@ void radiative_transfer_polarized(double *lightpath, int steps,
         // defined) one step. The final time this is done will be when
         // path_counter = 1; dl_current will then be at index 0 (path_counter -
         // 1).
-        if (POLARIZATION_ACTIVE && path_counter > 0) {
+        if (ANY_ACTIVE && path_counter > 0) {
             // Obtain the right k-vector, pointing back to observer, and
             // associated position. Pop into photon_u_current.
             LOOP_i {
@@ -845,7 +941,7 @@ void radiative_transfer_polarized(double *lightpath, int steps,
             }
 
             // One step: parallel transport of polarization vector.
-            rk4_step_f(photon_u_current, f_u, dl_current);
+            rk4_step_f(photon_u_current, f_u, POLARIZATION_ACTIVE, dl_current);
         }
     } // End of for(path_counter...
 
@@ -860,15 +956,26 @@ void radiative_transfer_polarized(double *lightpath, int steps,
         k_u[i] = lightpath[4 + i];
     }
 
-    double complex f_obs_tetrad_u[4] = {0., 0., 0., 0.};
-    construct_f_obs_tetrad_u(X_u, k_u, f_u, f_obs_tetrad_u);
+    double obs_tetrad_d[4][4];
+    construct_obs_tetrad_d(X_u, k_u, obs_tetrad_d);
 
-    LOOP_i IQUV[i] = 0.;
+    for (int f = 0; f < num_frequencies; f++) {
+        LOOP_i IQUV[f][i] = 0.;
 
-    if (POLARIZATION_ACTIVE) {
-        f_tetrad_to_stokes(Iinv, Iinv_pol, f_obs_tetrad_u, S_A);
+        if (POLARIZATION_ACTIVE[f]) {
+            // Convert f_u to f_obs_tetrad_u
+            double complex f_obs_tetrad_u[4];
+#if (FAST_FORWARD)
+            f_vacuum_to_f_tetrad(lightpath, obs_tetrad_d, f_u[f],
+                                 f_obs_tetrad_u);
+#else
+            f_to_f_tetrad(f_obs_tetrad_u, obs_tetrad_d, f_u[f]);
+#endif
+
+            f_tetrad_to_stokes(Iinv[f], Iinv_pol[f], f_obs_tetrad_u, S_A[f]);
 
-        // Construct final (NON-INVARIANT) Stokes params.
-        LOOP_i IQUV[i] = S_A[i] * pow(frequency, 3.);
+            // Construct final (NON-INVARIANT) Stokes params.
+            LOOP_i IQUV[f][i] = S_A[f][i] * pow(frequency[f], 3.);
+        }
     }
 }
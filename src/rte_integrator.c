@@ -15,6 +15,20 @@
 // FUNCTIONS
 ////////////
 
+// Radial band of radius r for the radius-decomposed spectra: 0 for r > 960,
+// then 240, 60 and 30 Rg, and 4 for r <= 30
+int radial_band(double r) {
+    if (r > 960)
+        return 0;
+    if (r > 240)
+        return 1;
+    if (r > 60)
+        return 2;
+    if (r > 30)
+        return 3;
+    return 4;
+}
+
 double radiative_transfer_unpolarized(double *lightpath, int steps,
                                       double *frequency,
                                       double IQUV[num_frequencies][4],
@@ -22,20 +36,21 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
                                       double tau[num_frequencies]) {
 
     int path_counter;
-    double pitch_ang, nu_p;
-
-    double X_u[4], k_d[4], k_u[4], k_u_s[4], dl_current, dl_current_s, r_path, r_path_prev = cutoff_outer;
-    double jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV;
+    double pitch_ang, nu_p[num_frequencies];
 
-    int rmin = 0;
+    double X_u[4], k_d[4], k_u[4], dl_current, dl_current_s;
+    double jI[num_frequencies], jQ[num_frequencies], jU[num_frequencies],
+        jV[num_frequencies];
+    double rQ[num_frequencies], rU[num_frequencies], rV[num_frequencies];
+    double aI[num_frequencies], aQ[num_frequencies], aU[num_frequencies],
+        aV[num_frequencies];
 
     double Rg = GGRAV * MBH / SPEED_OF_LIGHT / SPEED_OF_LIGHT; // Rg in cm
-    double g_dd[4][4], g_uu[4][4];
+    double C = Rg * PLANCK_CONSTANT /
+               (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
 
     double Icurrent;
 
-    double dtau_old = 0;
-
     struct GRMHD modvar;
     modvar.B = 0;
     modvar.n_e = 0.;
@@ -49,36 +64,11 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
     }
     modvar.igrid_c = -1;
 
-
-// Check the minimum radius reached by the photon in the geodesic
-#if (RADIAL_CUT)
+    // With RADIAL_CUT, the intensity of each radial band is transferred
+    // alongside the total. With RADIAL_CUT_SHARED, the bands are absorbed by
+    // all plasma and add up to the total intensity; without it, a band holds
+    // the emission and absorption of the plasma inside it alone.
     for (path_counter = steps - 1; path_counter > 0; path_counter--) {
-        LOOP_i {
-            X_u[i] = lightpath[path_counter * 9 + i];
-            k_u[i] = lightpath[path_counter * 9 + 4 + i];
-        }
-        r_path = get_r(X_u);
-        if (r_path <= r_path_prev){
-            if (r_path > 960) {
-                rmin = 1;
-                }
-            if (r_path > 240 && r_path <= 960) {
-                rmin = 2;
-                }
-            if (r_path > 60 && r_path <= 240) {
-                rmin = 3;
-                }    
-            if (r_path > 30 && r_path <= 60) {
-                rmin = 4;
-                }
-            if (r_path <= 30) {
-                rmin = 5;
-                break;
-                }
-            }
-    }
-    for(int j = 0; j < rmin; j++){
-     for (path_counter = steps - 1; path_counter > 0; path_counter--) {
         // Current position, wave vector, and dlambda
         LOOP_i {
             X_u[i] = lightpath[path_counter * 9 + i];
@@ -86,9 +76,6 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
         }
         dl_current = fabs(lightpath[(path_counter - 1) * 9 + 8]);
 
-        metric_dd(X_u, g_dd);
-        metric_uu(X_u, g_uu);
-
         if (get_fluid_params(X_u, &modvar)) {
             lower_index(X_u, k_u, k_d);
             pitch_ang = pitch_angle(X_u, k_u, modvar.B_u, modvar.U_u);
@@ -96,9 +83,27 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
             if (pitch_ang < 1e-9)
                 continue;
 
-            for (int f = 0; f < num_frequencies; f++) {
-                // Obtain pitch angle: still no units (geometric)
+#if (RADIAL_CUT)
+            int band = radial_band(get_r(X_u));
+#endif
+
+            // CGS UNITS USED FROM HERE ON OUT
+            //////////////////////////////////
+
+            // Compute the photon frequencies in the plasma frame; the wave
+            // vector scales with PLANCK_CONSTANT * frequency /
+            // (ELECTRON_MASS * c^2)
+            double redshift = freq_in_plasma_frame(modvar.U_u, k_d) *
+                              PLANCK_CONSTANT /
+                              (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+            for (int f = 0; f < num_frequencies; f++)
+                nu_p[f] = frequency[f] * redshift;
+
+            // Obtain emission coefficients in current plasma conditions
+            evaluate_coeffs_batch(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV,
+                                  nu_p, num_frequencies, modvar, pitch_ang);
 
+            for (int f = 0; f < num_frequencies; f++) {
                 Icurrent = IQUV[f][0];
 
                 dl_current_s =
@@ -106,34 +111,9 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
                     (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT) /
                     (PLANCK_CONSTANT * frequency[f]);
 
-                // CGS UNITS USED FROM HERE ON OUT
-                //////////////////////////////////
-
-                // Scale the wave vector to correct energy
-                LOOP_i k_u_s[i] =
-                    k_u[i] * PLANCK_CONSTANT * frequency[f] /
-                    (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
-
-                // lower the index of the wavevector
-                lower_index(X_u, k_u_s, k_d);
-
-                // Compute the photon frequency in the plasma frame:
-                nu_p = freq_in_plasma_frame(modvar.U_u, k_d);
-                // Obtain emission coefficient in current plasma conditions
-
-#if (EMISUSER)
-                evaluate_coeffs_user(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                     &aQ, &aU, &aV, nu_p, modvar, pitch_ang);
-#else
-                evaluate_coeffs_single(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                       &aQ, &aU, &aV, nu_p, modvar, pitch_ang, (j+1), get_r(X_u));
-#endif
-                double C = Rg * PLANCK_CONSTANT /
-                           (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
-
-                double dtau = (aI * dl_current_s * C + dtau_old);
-                double K_inv = aI;
-                double j_inv = jI;
+                double dtau = aI[f] * dl_current_s * C;
+                double K_inv = aI[f];
+                double j_inv = jI[f];
 
                 tau[f] += dtau;
 #if (DEBUG)
@@ -141,7 +121,7 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
                     fprintf(stderr, "NaN emissivity! I = %+.15e\n", Icurrent);
                     fprintf(stderr, "NaN emissivity! j_nu = %+.15e\n", j_inv);
                     fprintf(stderr, "NaN emissivity! nu_plasmaframe = %+.15e\n",
-                            nu_p);
+                            nu_p[f]);
                     fprintf(stderr, "NaN emissivity! ne %e te %e B %e\n",
                             modvar.n_e, modvar.theta_e, modvar.B);
                     fprintf(stderr, "NaN emissivity! Unorm %e\n",
@@ -151,122 +131,175 @@ double radiative_transfer_unpolarized(double *lightpath, int steps,
                 }
 #endif
 
-                if (jI == jI) {
-                    double Ii = Icurrent;
+                if (jI[f] == jI[f] && K_inv != 0) {
                     double S = j_inv / K_inv;
-                    if (K_inv == 0)
-                        Icurrent = Ii;
-                    else if (dtau < 1.e-5)
-                        Icurrent = Ii - (Ii - S) * (0.166666667 * dtau *
-                                                    (6. - dtau * (3. - dtau)));
-                    else {
-                        double efac = exp(-dtau);
-                        Icurrent = Ii * efac + S * (1. - efac);
+                    // fraction of the intensity transmitted and of the source
+                    // function added by this step
+                    double trans, gain;
+                    if (dtau < 1.e-5) {
+                        gain = 0.166666667 * dtau * (6. - dtau * (3. - dtau));
+                        trans = 1. - gain;
+                    } else {
+                        trans = exp(-dtau);
+                        gain = 1. - trans;
                     }
+                    Icurrent = Icurrent * trans + S * gain;
+
+#if (RADIAL_CUT && RADIAL_CUT_SHARED)
+                    for (int b = 0; b < 5; b++)
+                        I_radial_cut[f][b] *= trans;
+                    I_radial_cut[f][band] += S * gain;
+#elif (RADIAL_CUT)
+                    I_radial_cut[f][band] =
+                        I_radial_cut[f][band] * trans + S * gain;
+#endif
                 }
-                dtau_old = 0;
 
-                I_radial_cut[f][j] = Icurrent;
+                IQUV[f][0] = Icurrent;
             }
         }
-    }}
-#else
-
-        for (path_counter = steps - 1; path_counter > 0; path_counter--) {
-        // Current position, wave vector, and dlambda
-        LOOP_i {
-            X_u[i] = lightpath[path_counter * 9 + i];
-            k_u[i] = lightpath[path_counter * 9 + 4 + i];
-        }
-        dl_current = fabs(lightpath[(path_counter - 1) * 9 + 8]);
+    }
 
-        metric_dd(X_u, g_dd);
-        metric_uu(X_u, g_uu);
+    // IQUV[0] = Icurrent * pow(frequency, 3.);
 
-        if (get_fluid_params(X_u, &modvar)) {
-            lower_index(X_u, k_u, k_d);
-            pitch_ang = pitch_angle(X_u, k_u, modvar.B_u, modvar.U_u);
+    return 1;
+}
 
-            if (pitch_ang < 1e-9)
-                continue;
+// Starts the observer-to-source transfer of a ray into IQUV, I_radial_cut
+// and tau, continuing from the optical depth tau already in front
+void transfer_start(struct Transfer *rt, double *frequency,
+                    double IQUV[num_frequencies][4],
+                    double I_radial_cut[num_frequencies][5],
+                    double tau[num_frequencies]) {
+    rt->frequency = frequency;
+    rt->IQUV = IQUV;
+    rt->I_radial_cut = I_radial_cut;
+    rt->tau = tau;
+    for (int f = 0; f < num_frequencies; f++)
+        rt->trans_front[f] = exp(-tau[f]);
+
+    rt->modvar.B = 0;
+    rt->modvar.n_e = 0.;
+    rt->modvar.theta_e = 0;
 
-            for (int f = 0; f < num_frequencies; f++) {
-                // Obtain pitch angle: still no units (geometric)
+    LOOP_i {
+        rt->modvar.B_u[i] = 0;
+        rt->modvar.U_u[i] = 0;
+        rt->modvar.B_d[i] = 0;
+        rt->modvar.U_d[i] = 0;
+    }
+    rt->modvar.igrid_c = -1;
+}
 
-                Icurrent = IQUV[f][0];
+// Adds the step of size dl_current, ending at the lightpath point X_u, k_u,
+// to the observer-to-source transfer: its emission times the transmittance
+// exp(-tau) of the plasma in front of it. The steps of a ray give the same
+// intensity as radiative_transfer_unpolarized. Returns 1 once tau exceeds
+// TAU_STOP at all frequencies, after which the rest of the ray adds less
+// than exp(-TAU_STOP) of its source function.
+int transfer_step(struct Transfer *rt, double X_u[4], double k_u[4],
+                  double dl_current) {
 
-                dl_current_s =
-                    dl_current *
-                    (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT) /
-                    (PLANCK_CONSTANT * frequency[f]);
+    double pitch_ang, nu_p[num_frequencies];
 
-                // CGS UNITS USED FROM HERE ON OUT
-                //////////////////////////////////
+    double k_d[4], dl_current_s;
+    double jI[num_frequencies], jQ[num_frequencies], jU[num_frequencies],
+        jV[num_frequencies];
+    double rQ[num_frequencies], rU[num_frequencies], rV[num_frequencies];
+    double aI[num_frequencies], aQ[num_frequencies], aU[num_frequencies],
+        aV[num_frequencies];
 
-                // Scale the wave vector to correct energy
-                LOOP_i k_u_s[i] =
-                    k_u[i] * PLANCK_CONSTANT * frequency[f] /
-                    (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+    double Rg = GGRAV * MBH / SPEED_OF_LIGHT / SPEED_OF_LIGHT; // Rg in cm
+    double C = Rg * PLANCK_CONSTANT /
+               (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
 
-                // lower the index of the wavevector
-                lower_index(X_u, k_u_s, k_d);
+    double *frequency = rt->frequency;
+    double *tau = rt->tau;
 
-                // Compute the photon frequency in the plasma frame:
-                nu_p = freq_in_plasma_frame(modvar.U_u, k_d);
-                // Obtain emission coefficient in current plasma conditions
+    if (!get_fluid_params(X_u, &rt->modvar))
+        return 0;
 
-#if (EMISUSER)
-                evaluate_coeffs_user(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                     &aQ, &aU, &aV, nu_p, modvar, pitch_ang);
-#else
-                evaluate_coeffs_single(&jI, &jQ, &jU, &jV, &rQ, &rU, &rV, &aI,
-                                       &aQ, &aU, &aV, nu_p, modvar, pitch_ang, 0, get_r(X_u));
-#endif
-                double C = Rg * PLANCK_CONSTANT /
-                           (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+    lower_index(X_u, k_u, k_d);
+    pitch_ang = pitch_angle(X_u, k_u, rt->modvar.B_u, rt->modvar.U_u);
 
-                double dtau = (aI * dl_current_s * C + dtau_old);
-                double K_inv = aI;
-                double j_inv = jI;
+    if (pitch_ang < 1e-9)
+        return 0;
 
-                tau[f] += dtau;
-#if (DEBUG)
-                if ((j_inv != j_inv || isnan(Icurrent))) {
-                    fprintf(stderr, "NaN emissivity! I = %+.15e\n", Icurrent);
-                    fprintf(stderr, "NaN emissivity! j_nu = %+.15e\n", j_inv);
-                    fprintf(stderr, "NaN emissivity! nu_plasmaframe = %+.15e\n",
-                            nu_p);
-                    fprintf(stderr, "NaN emissivity! ne %e te %e B %e\n",
-                            modvar.n_e, modvar.theta_e, modvar.B);
-                    fprintf(stderr, "NaN emissivity! Unorm %e\n",
-                            four_velocity_norm(X_u, modvar.U_u) + 1);
-                    fprintf(stderr, "NaN emissivity! knorm %e\n",
-                            four_velocity_norm(X_u, k_u));
-                }
+#if (RADIAL_CUT)
+    int band = radial_band(get_r(X_u));
 #endif
 
-                if (jI == jI) {
-                    double Ii = Icurrent;
-                    double S = j_inv / K_inv;
-                    if (K_inv == 0)
-                        Icurrent = Ii;
-                    else if (dtau < 1.e-5)
-                        Icurrent = Ii - (Ii - S) * (0.166666667 * dtau *
-                                                    (6. - dtau * (3. - dtau)));
-                    else {
-                        double efac = exp(-dtau);
-                        Icurrent = Ii * efac + S * (1. - efac);
-                    }
-                }
-                dtau_old = 0;
-
-                IQUV[f][0] = Icurrent;
+    // Compute the photon frequencies in the plasma frame, as in
+    // radiative_transfer_unpolarized
+    double redshift = freq_in_plasma_frame(rt->modvar.U_u, k_d) *
+                      PLANCK_CONSTANT /
+                      (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT);
+    for (int f = 0; f < num_frequencies; f++)
+        nu_p[f] = frequency[f] * redshift;
+
+    // Obtain emission coefficients in current plasma conditions
+    evaluate_coeffs_batch(jI, jQ, jU, jV, rQ, rU, rV, aI, aQ, aU, aV, nu_p,
+                          num_frequencies, rt->modvar, pitch_ang);
+
+    int opaque = 1;
+    for (int f = 0; f < num_frequencies; f++) {
+        dl_current_s = dl_current *
+                       (ELECTRON_MASS * SPEED_OF_LIGHT * SPEED_OF_LIGHT) /
+                       (PLANCK_CONSTANT * frequency[f]);
+
+        double dtau = aI[f] * dl_current_s * C;
+        double K_inv = aI[f];
+        double j_inv = jI[f];
+
+        tau[f] += dtau;
+
+        if (jI[f] == jI[f] && K_inv != 0) {
+            double S = j_inv / K_inv;
+            // fraction of the intensity transmitted and of the source
+            // function added by this step
+            double trans, gain;
+            if (dtau < 1.e-5) {
+                gain = 0.166666667 * dtau * (6. - dtau * (3. - dtau));
+                trans = 1. - gain;
+            } else {
+                trans = exp(-dtau);
+                gain = 1. - trans;
             }
+            rt->IQUV[f][0] += rt->trans_front[f] * S * gain;
+
+#if (RADIAL_CUT)
+            rt->I_radial_cut[f][band] += rt->trans_front[f] * S * gain;
+#endif
+            rt->trans_front[f] *= trans;
         }
+
+        opaque = opaque && tau[f] > TAU_STOP;
     }
-#endif
 
-    // IQUV[0] = Icurrent * pow(frequency, 3.);
+    return opaque;
+}
 
-    return 1;
+// Observer-to-source transfer of the lightpath steps first to steps - 1, in
+// continuation of the steps before first; returns 1 as soon as tau exceeds
+// TAU_STOP at all frequencies
+int radiative_transfer_observer(double *lightpath, int first, int steps,
+                                double *frequency,
+                                double IQUV[num_frequencies][4],
+                                double I_radial_cut[num_frequencies][5],
+                                double tau[num_frequencies]) {
+    struct Transfer rt;
+    transfer_start(&rt, frequency, IQUV, I_radial_cut, tau);
+
+    // The first entry is the camera, which has no step in front of it
+    for (int path_counter = (first > 1 ? first : 1); path_counter < steps;
+         path_counter++) {
+        // Current position, wave vector, and dlambda
+        double *entry = &lightpath[path_counter * 9];
+        double dl_current = fabs(lightpath[(path_counter - 1) * 9 + 8]);
+
+        if (transfer_step(&rt, &entry[0], &entry[4], dl_current))
+            return 1;
+    }
+
+    return 0;
 }